@@ -0,0 +1,250 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "handler.h"
+#include "threadpool.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/* pc-batch : reprocesses saved requests with the same code as the server.
+ * Input files hold one request after another, each as a u32 big endian length followed by the request bytes.
+ * The requests are handled in parallel on the shared thread pool and the log messages are written in input order.
+ */
+
+namespace
+{
+/** keeps the response to one request, to tell if it was accepted */
+class ResponseWriter final : public Writer
+{
+public:
+    string response;
+    virtual void writeByte(uint8_t v) override
+    {
+        response += (char)v;
+    }
+};
+
+/** one request inside a mapped file */
+struct Request
+{
+    shared_ptr<const uint8_t> mem; // keeps the file mapped
+    size_t size;
+};
+
+struct Result
+{
+    string messages;
+    bool accepted = false;
+};
+
+/** @return the contents of fileName mapped read only, null if the file is empty
+ * @param size set to the file size
+ */
+shared_ptr<const uint8_t> mapFile(const string & fileName, size_t & size)
+{
+    int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1)
+        throw IOException("IO Error : can't open " + fileName + " : " + strerror(errno));
+    struct stat st;
+    if(fstat(fd, &st) == -1)
+    {
+        close(fd);
+        throw IOException("IO Error : can't read " + fileName + " : " + strerror(errno));
+    }
+    size = st.st_size;
+    if(size == 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+    void * pmem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pmem == MAP_FAILED)
+        throw IOException("IO Error : can't map " + fileName + " : " + strerror(errno));
+    madvise(pmem, size, MADV_SEQUENTIAL);
+    size_t mappedSize = size;
+    return shared_ptr<const uint8_t>((const uint8_t *)pmem, [mappedSize](const uint8_t * mem)
+    {
+        munmap((void *)mem, mappedSize);
+    });
+}
+
+/** splits a mapped file into its requests
+ * @throw IOException if the last request is cut off
+ */
+void splitRequests(const string & fileName, shared_ptr<const uint8_t> mem, size_t size, vector<Request> & requests)
+{
+    size_t location = 0;
+    while(location < size)
+    {
+        if(size - location < 4)
+            throw IOException("IO Error : truncated request length at offset " + to_string(location) + " in " + fileName);
+        const uint8_t * p = mem.get() + location;
+        size_t length = ((size_t)p[0] << 24) | ((size_t)p[1] << 16) | ((size_t)p[2] << 8) | p[3];
+        location += 4;
+        if(size - location < length)
+            throw IOException("IO Error : truncated request at offset " + to_string(location - 4) + " in " + fileName);
+        // aliases the mapping so every request keeps the whole file mapped
+        requests.push_back(Request{shared_ptr<const uint8_t>(mem, mem.get() + location), length});
+        location += length;
+    }
+}
+
+void handleRequest(const Request & request, Result & result)
+{
+    ReaderIStream is(make_shared<MemoryReader>(request.mem, request.size));
+    shared_ptr<ResponseWriter> writer = make_shared<ResponseWriter>();
+    string deviceName;
+    vector<Event> events;
+    {
+        WriterOStream os(writer);
+        connectionHandler(is, os, "batch", result.messages, deviceName, events);
+    }
+    result.accepted = (writer->response == "1");
+}
+
+void usage(const char * programName)
+{
+    cerr << "usage : " << programName << " [--key <key file>] [--output <file>] [--batch <requests>] [--info] [--epoch-times] <request file>...\n";
+}
+}
+
+int main(int argc, char ** argv)
+{
+    string keyFileName = "dec-key.txt";
+    bool isKeyFileOptional = true;
+    string outputFileName;
+    size_t batchSize = 4096;
+    vector<string> inputFileNames;
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if(arg == "--key" && i + 1 < argc)
+        {
+            keyFileName = argv[++i];
+            isKeyFileOptional = false;
+        }
+        else if(arg == "--output" && i + 1 < argc)
+            outputFileName = argv[++i];
+        else if(arg == "--batch" && i + 1 < argc)
+            batchSize = max(atol(argv[++i]), 1L);
+        else if(arg == "--info")
+            useInfoMessages = true;
+        else if(arg == "--epoch-times")
+            useEpochTimes = true;
+        else if(arg.size() > 2 && arg.substr(0, 2) == "--")
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        else
+            inputFileNames.push_back(arg);
+    }
+    if(inputFileNames.empty())
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    try
+    {
+        if(!isKeyFileOptional || access(keyFileName.c_str(), F_OK) == 0)
+            setKeyRing(loadKeyRing(keyFileName));
+    }
+    catch(exception & e)
+    {
+        cerr << "Error : " << e.what() << endl;
+        return 1;
+    }
+    FILE * output = stdout;
+    if(outputFileName != "")
+    {
+        output = fopen(outputFileName.c_str(), "w");
+        if(!output)
+        {
+            cerr << "Error : can't open " << outputFileName << " : " << strerror(errno) << endl;
+            return 1;
+        }
+    }
+    chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+    size_t requestCount = 0, acceptedCount = 0, byteCount = 0;
+    try
+    {
+        for(const string & fileName : inputFileNames)
+        {
+            size_t size;
+            shared_ptr<const uint8_t> mem = mapFile(fileName, size);
+            vector<Request> requests;
+            if(mem)
+                splitRequests(fileName, mem, size, requests);
+            mem = nullptr;
+            // batches bound the memory for results while keeping every core busy
+            vector<Result> results;
+            for(size_t batchStart = 0; batchStart < requests.size(); batchStart += batchSize)
+            {
+                size_t batchEnd = min(batchStart + batchSize, requests.size());
+                results.assign(batchEnd - batchStart, Result());
+                {
+                    TaskGroup tasks;
+                    for(size_t i = batchStart; i < batchEnd; i++)
+                    {
+                        const Request * prequest = &requests[i];
+                        Result * presult = &results[i - batchStart];
+                        tasks.run([prequest, presult]()
+                        {
+                            handleRequest(*prequest, *presult);
+                        });
+                    }
+                    tasks.wait();
+                }
+                for(size_t i = batchStart; i < batchEnd; i++)
+                {
+                    const Result & result = results[i - batchStart];
+                    fwrite(result.messages.data(), 1, result.messages.size(), output);
+                    requestCount++;
+                    if(result.accepted)
+                        acceptedCount++;
+                    byteCount += requests[i].size;
+                }
+            }
+        }
+    }
+    catch(exception & e)
+    {
+        cerr << "Error : " << e.what() << endl;
+        return 1;
+    }
+    if(fflush(output) != 0 || (output != stdout && fclose(output) != 0))
+    {
+        cerr << "Error : can't write output : " << strerror(errno) << endl;
+        return 1;
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - startTime;
+    fprintf(stderr, "%zu requests (%zu accepted, %zu refused), %.1f MB in %.2f s : %.1f requests/s %.2f MB/s\n",
+            requestCount, acceptedCount, requestCount - acceptedCount, byteCount / 1e6, elapsed.count(),
+            requestCount / max(elapsed.count(), 1e-9), byteCount / 1e6 / max(elapsed.count(), 1e-9));
+    return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "handler.h"
+#include "blockcrypt.h"
+#include "chacha20poly1305.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+
+using namespace std;
+
+/* bench_handler : runs connectionHandler over in-memory requests in a tight loop,
+ * to measure parsing and decryption without the network.
+ */
+
+namespace
+{
+atomic<uint64_t> allocationCount(0);
+}
+
+void * operator new(size_t size)
+{
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    void * retval = malloc(size == 0 ? 1 : size);
+    if(retval == nullptr)
+        throw bad_alloc();
+    return retval;
+}
+
+void operator delete(void * p) noexcept
+{
+    free(p);
+}
+
+namespace
+{
+class NullWriter final : public Writer
+{
+public:
+    virtual void writeByte(uint8_t) override
+    {
+    }
+};
+
+struct Key
+{
+    BigUnsigned modulus = 0_bu;
+    BigUnsigned privateExponent = 0_bu;
+    BigUnsigned publicExponent = 0_bu;
+};
+
+void loadKeyFile(string fileName, BigUnsigned & modulus, BigUnsigned & exponent)
+{
+    ifstream is(fileName.c_str());
+    string modulusString, exponentString;
+    if(!(is >> modulusString >> exponentString))
+        throw runtime_error("can't load key from " + fileName);
+    modulus = BigUnsigned::parseHexByteString(modulusString);
+    exponent = BigUnsigned::parseHexByteString(exponentString);
+}
+
+void appendBigEndian(string & str, uint32_t v, size_t byteCount)
+{
+    for(size_t i = byteCount; i-- > 0;)
+        str += (char)(uint8_t)(v >> (8 * i));
+}
+
+/** @return a request of type with eventCount events, encrypted with key unless type is '0'.
+ * Types '4' to '6' are '1' to '3' with the key id after the type byte.
+ */
+string makeRequest(char type, size_t eventCount, const Key & key)
+{
+    const char baseType = (type >= '4' && type <= '6' ? type - ('4' - '1') : type);
+    const string deviceName = "bench-device", statsString = "bench stats";
+    const time_t baseTime = 0x5E000000;
+    string plainText;
+    if(baseType == '2')
+    {
+        appendBigEndian(plainText, deviceName.size(), 2);
+        plainText += deviceName;
+        appendBigEndian(plainText, statsString.size(), 2);
+        plainText += statsString;
+        for(size_t i = 0; i < eventCount; i++)
+        {
+            string text = (i % 2 == 0 ? "enter" : "exit");
+            appendBigEndian(plainText, baseTime + i, 4);
+            appendBigEndian(plainText, text.size(), 2);
+            plainText += text;
+        }
+    }
+    else
+    {
+        plainText = deviceName + "\n" + statsString + "\n";
+        char buffer[64];
+        for(size_t i = 0; i < eventCount; i++)
+        {
+            snprintf(buffer, sizeof(buffer), "%llx %s\n", (unsigned long long)(baseTime + i), (i % 2 == 0 ? "enter" : "exit"));
+            plainText += buffer;
+        }
+    }
+    if(type == '0')
+        return "0" + plainText;
+    size_t blockSize = getBlockPlainTextSize(key.modulus);
+    string retval(1, type);
+    if(type != baseType)
+        appendBigEndian(retval, getKeyId(key.modulus), 4);
+    if(baseType == '3')
+    {
+        // one block holding the session key and nonce, then the ChaCha20-Poly1305 encrypted payload and its tag
+        string additionalData = retval;
+        string sessionKey(ChaCha20Poly1305::KeySize + ChaCha20Poly1305::NonceSize, '\0');
+        for(char & ch : sessionKey)
+            ch = (char)rand();
+        string cipherText(key.modulus.byteCount(), '\0');
+        encryptBlock(sessionKey, key.publicExponent, key.modulus).toRawBytes((uint8_t *)&cipherText[0], cipherText.size());
+        retval += cipherText;
+        const uint8_t * pkey = (const uint8_t *)sessionKey.data();
+        ChaCha20Poly1305 cipher(pkey, pkey + ChaCha20Poly1305::KeySize);
+        uint8_t tag[ChaCha20Poly1305::TagSize];
+        cipher.encrypt(plainText, tag, additionalData);
+        retval += plainText;
+        retval.append((const char *)tag, sizeof(tag));
+        return retval;
+    }
+    vector<BigUnsigned> blocks;
+    for(size_t i = 0; i < plainText.size(); i += blockSize)
+        blocks.push_back(encryptBlock(plainText.substr(i, blockSize), key.publicExponent, key.modulus));
+    if(baseType == '1')
+    {
+        for(const BigUnsigned & block : blocks)
+            retval += block.toBase64() + "\n";
+        return retval;
+    }
+    appendBigEndian(retval, blocks.size(), 4);
+    size_t cipherTextSize = key.modulus.byteCount();
+    for(const BigUnsigned & block : blocks)
+    {
+        string cipherText(cipherTextSize, '\0');
+        block.toRawBytes((uint8_t *)&cipherText[0], cipherText.size());
+        retval += cipherText;
+    }
+    return retval;
+}
+
+/** @param keyRing used unless type is '0', unkeyed requests are decrypted by trial if it holds several keys */
+void runCase(char type, size_t eventCount, const Key & key, shared_ptr<const KeyRing> keyRing, double seconds)
+{
+    setKeyRing(type == '0' ? nullptr : keyRing);
+    string request = makeRequest(type, eventCount, key);
+    shared_ptr<const uint8_t> requestMemory((const uint8_t *)request.data(), [](const uint8_t *){});
+    string messages, deviceName;
+    vector<Event> events;
+    auto runBatch = [&]()
+    {
+        for(size_t i = 0; i < 16; i++)
+        {
+            ReaderIStream is(make_shared<MemoryReader>(requestMemory, request.size()));
+            WriterOStream os(make_shared<NullWriter>());
+            messages.clear();
+            connectionHandler(is, os, "bench", messages, deviceName, events);
+            if(events.size() != eventCount)
+                throw runtime_error("request not accepted : " + messages);
+        }
+    };
+    runBatch(); // warm up buffers and the thread pool
+    uint64_t requestCount = 0, allocationsAtStart = allocationCount.load(memory_order_relaxed);
+    chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+    chrono::duration<double> elapsed(0);
+    do
+    {
+        runBatch();
+        requestCount += 16;
+        elapsed = chrono::steady_clock::now() - startTime;
+    }
+    while(elapsed.count() < seconds);
+    uint64_t allocations = allocationCount.load(memory_order_relaxed) - allocationsAtStart;
+    printf("type %c  key %5u bits  events %5u : %10.1f requests/s %8.2f MB/s %8.1f allocations/request\n", type,
+           type == '0' ? 0U : (unsigned)(key.modulus.byteCount() * 8), (unsigned)eventCount, requestCount / elapsed.count(),
+           requestCount * request.size() / elapsed.count() / 1e6, (double)allocations / requestCount);
+    fflush(stdout);
+}
+}
+
+int main(int argc, char ** argv)
+{
+    vector<size_t> eventCounts = {1, 10, 100, 1000};
+    string types = "0123";
+    vector<Key> keys;
+    double seconds = 1;
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if(arg == "--key" && i + 2 < argc)
+        {
+            Key key;
+            BigUnsigned publicModulus;
+            try
+            {
+                loadKeyFile(argv[i + 1], key.modulus, key.privateExponent);
+                loadKeyFile(argv[i + 2], publicModulus, key.publicExponent);
+                if(publicModulus != key.modulus || getBlockPlainTextSize(key.modulus) == 0)
+                    throw runtime_error(string("keys in ") + argv[i + 1] + " and " + argv[i + 2] + " don't match");
+            }
+            catch(exception & e)
+            {
+                cerr << "Error : " << e.what() << endl;
+                return 1;
+            }
+            keys.push_back(key);
+            i += 2;
+        }
+        else if(arg == "--events" && i + 1 < argc)
+        {
+            eventCounts.clear();
+            istringstream is(argv[++i]);
+            string count;
+            while(getline(is, count, ','))
+                eventCounts.push_back(atol(count.c_str()));
+        }
+        else if(arg == "--types" && i + 1 < argc)
+            types = argv[++i];
+        else if(arg == "--seconds" && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else
+        {
+            cerr << "usage : " << argv[0] << " [--key <private key file> <public key file>]... [--events <count>,...] [--types <request types, like 0123456>] [--seconds <seconds per case>]\n";
+            return 1;
+        }
+    }
+    vector<shared_ptr<const DecryptionKey>> decryptionKeys;
+    for(const Key & key : keys)
+        decryptionKeys.push_back(make_shared<const DecryptionKey>(key.modulus, key.privateExponent));
+    shared_ptr<const KeyRing> keyRing = make_shared<const KeyRing>(decryptionKeys);
+    try
+    {
+        for(char type : types)
+        {
+            if(type < '0' || type > '6')
+                throw runtime_error(string("invalid request type ") + type);
+            for(size_t eventCount : eventCounts)
+            {
+                if(type == '0')
+                {
+                    runCase(type, eventCount, Key(), keyRing, seconds);
+                    continue;
+                }
+                for(const Key & key : keys)
+                    runCase(type, eventCount, key, keyRing, seconds);
+            }
+        }
+    }
+    catch(exception & e)
+    {
+        cerr << "Error : " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
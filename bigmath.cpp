@@ -1,8 +1,6 @@
 #include "bigmath.h"
 #include <iostream>
 
-BigUnsigned::Data * BigUnsigned::smallNumbers = NULL;
-
 static inline void addWithCarry(WordType a, WordType b, bool carryIn, WordType & result, bool & carryOut)
 {
     DoubleWordType v = a;
@@ -194,7 +192,7 @@ BigUnsigned BigUnsigned::fromByteString(string str)
     retval.data->words[wordPos] |= ((WordType)currentByte << (8 * bytePos));
     for(size_t i = 0; i < str.size(); i++)
     {
-        unsigned currentByte = str[i];
+        unsigned currentByte = (uint8_t)str[i];
         size_t bytePos = byteCount - ++byteNumber;
         size_t wordPos = bytePos / BytesPerWord;
         retval.data->words[wordPos] |= ((WordType)currentByte << (8 * bytePos));
@@ -221,6 +219,41 @@ string BigUnsigned::toByteString() const
     return retval;
 }
 
+BigUnsigned BigUnsigned::fromRawBytes(const uint8_t * bytes, size_t byteCount)
+{
+    size_t wordCount = (byteCount + BytesPerWord - 1) / BytesPerWord;
+    if(wordCount == 0)
+        wordCount = 1;
+    BigUnsigned retval(0, wordCount);
+    for(size_t i = 0, j = byteCount - 1; i < byteCount; i++, j--)
+    {
+        retval.data->words[j / BytesPerWord] |= ((WordType)bytes[i] << (8 * (j % BytesPerWord)));
+    }
+    retval.normalize();
+    return retval;
+}
+
+void BigUnsigned::toRawBytes(uint8_t * bytes, size_t byteCount) const
+{
+    if(this->byteCount() > byteCount)
+        handleError("number too big for BigUnsigned::toRawBytes");
+    for(size_t i = 0, j = byteCount - 1; i < byteCount; i++, j--)
+    {
+        if(j / BytesPerWord >= data->size)
+            bytes[i] = 0;
+        else
+            bytes[i] = ((data->words[j / BytesPerWord]) >> (j % BytesPerWord) * 8) & 0xFF;
+    }
+}
+
+size_t BigUnsigned::byteCount() const
+{
+    size_t byteCount = data->size * BytesPerWord;
+    while(byteCount > 0 && (((data->words[(byteCount - 1) / BytesPerWord]) >> ((byteCount - 1) % BytesPerWord) * 8) & 0xFF) == 0)
+        byteCount--;
+    return byteCount;
+}
+
 const BigUnsigned & BigUnsigned::operator +=(BigUnsigned b)
 {
     if(b.data->size == 1)
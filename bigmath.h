@@ -8,6 +8,7 @@
 #include <cmath>
 #include <climits>
 #include <utility> // for swap
+#include <atomic>
 
 using namespace std;
 
@@ -24,7 +25,7 @@ class BigUnsigned
         WordType * words;
         WordType word;
         size_t size, allocated;
-        size_t refCount;
+        atomic_size_t refCount; // atomic so values can be shared between threads
         Data(WordType v = 0, size_t size = 1)
             : words(&word), word(v), size(size), allocated(size), refCount(1)
         {
@@ -97,8 +98,7 @@ class BigUnsigned
         }
         void delRef()
         {
-            refCount--;
-            if(refCount == 0)
+            if(--refCount == 0)
             {
                 delete this;
             }
@@ -130,21 +130,25 @@ class BigUnsigned
         return digit - 0xA + 'A';
     }
     enum {SmallNumberCount = 32};
-    static Data * smallNumbers;
+    static Data * getSmallNumbers()
+    {
+        static Data * const smallNumbers = []()
+        {
+            Data * retval = new Data[SmallNumberCount];
+            for(WordType i = 0; i < SmallNumberCount; i++)
+            {
+                retval[i].words[0] = i;
+            }
+            return retval;
+        }();
+        return smallNumbers;
+    }
 public:
     BigUnsigned(WordType v = 0)
     {
         if(v < SmallNumberCount)
         {
-            if(!smallNumbers)
-            {
-                smallNumbers = new Data[SmallNumberCount];
-                for(WordType i = 0; i < SmallNumberCount; i++)
-                {
-                    smallNumbers[i].words[0] = i;
-                }
-            }
-            data = &smallNumbers[v];
+            data = &getSmallNumbers()[v];
             data->addRef();
         }
         else
@@ -196,6 +200,9 @@ public:
     string toHexByteString() const;
     static BigUnsigned fromByteString(string str);
     string toByteString() const;
+    static BigUnsigned fromRawBytes(const uint8_t * bytes, size_t byteCount); // big endian
+    void toRawBytes(uint8_t * bytes, size_t byteCount) const; // big endian, zero padded
+    size_t byteCount() const;
     static BigUnsigned parse(string str, unsigned base);
     static BigUnsigned parse(string str, bool useOctal = false)
     {
@@ -0,0 +1,40 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef BINARYIO_H_INCLUDED
+#define BINARYIO_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+inline void appendLittleEndian(string & str, uint64_t v, size_t byteCount)
+{
+    for(size_t i = 0; i < byteCount; i++, v >>= 8)
+        str += (char)(uint8_t)v;
+}
+
+inline uint64_t readLittleEndian(const uint8_t * bytes, size_t byteCount)
+{
+    uint64_t retval = 0;
+    for(size_t i = byteCount; i > 0; i--)
+        retval = (retval << 8) | bytes[i - 1];
+    return retval;
+}
+
+#endif // BINARYIO_H_INCLUDED
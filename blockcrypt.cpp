@@ -0,0 +1,65 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "blockcrypt.h"
+#include "checksum.h"
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+size_t getBlockPlainTextSize(const BigUnsigned & modulus)
+{
+    // the framed block has 8 * size + 1 + randomBitCount + 13 bits, the modulus has more than 8 * (byteCount - 1) bits
+    size_t byteCount = modulus.byteCount();
+    if(byteCount < 12)
+        return 0;
+    return byteCount - 11;
+}
+
+BigUnsigned encryptBlock(const string & plainText, const BigUnsigned & exponent, const BigUnsigned & modulus)
+{
+    static thread_local mt19937_64 rng{random_device()()};
+    uint64_t randomValue = rng();
+    uint8_t randomBytes[randomBitCount / 8];
+    for(size_t i = 0; i < sizeof(randomBytes); i++)
+        randomBytes[i] = (uint8_t)(randomValue >> (8 * i));
+    BigUnsigned v = (BigUnsigned::fromByteString(plainText) << randomBitCount) | BigUnsigned::fromRawBytes(randomBytes, sizeof(randomBytes));
+    v = v * checkSumModulus + v % checkSumModulus;
+    if(v >= modulus)
+        throw runtime_error("plain text too long for the key");
+    return powMod(v, exponent, modulus);
+}
+
+string decryptBlock(BigUnsigned v, const BigUnsigned & exponent, const BigUnsigned & modulus)
+{
+    v = powMod(v, exponent, modulus);
+    BigUnsigned checkSum;
+    BigUnsigned::divMod(v, checkSumModulus, v, checkSum);
+    if(checkSum != v % checkSumModulus)
+        throw runtime_error("checksum doesn't match");
+    v >>= randomBitCount;
+    return v.toByteString();
+}
+
+uint32_t getKeyId(const BigUnsigned & modulus)
+{
+    vector<uint8_t> bytes(modulus.byteCount());
+    modulus.toRawBytes(bytes.data(), bytes.size());
+    return crc32(bytes.data(), bytes.size());
+}
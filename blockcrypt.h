@@ -0,0 +1,44 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef BLOCKCRYPT_H_INCLUDED
+#define BLOCKCRYPT_H_INCLUDED
+
+#include "bigmath.h"
+#include <string>
+
+using namespace std;
+
+/** the RSA block framing used by requests : the plain text bytes behind a 1 byte, followed by randomBitCount random bits,
+ * multiplied by checkSumModulus with the value modulo checkSumModulus added as a check sum.
+ */
+const size_t randomBitCount = 64;
+const WordType checkSumModulus = 8191;
+
+/** @return the number of plain text bytes that fit in one block for modulus */
+size_t getBlockPlainTextSize(const BigUnsigned & modulus);
+
+/** @param plainText at most getBlockPlainTextSize(modulus) bytes */
+BigUnsigned encryptBlock(const string & plainText, const BigUnsigned & exponent, const BigUnsigned & modulus);
+
+/** @throw runtime_error if the check sum doesn't match */
+string decryptBlock(BigUnsigned v, const BigUnsigned & exponent, const BigUnsigned & modulus);
+
+/** @return the id keyed requests name the key with : the CRC-32 of the big endian modulus, known to both the public and private key */
+uint32_t getKeyId(const BigUnsigned & modulus);
+
+#endif // BLOCKCRYPT_H_INCLUDED
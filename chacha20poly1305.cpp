@@ -0,0 +1,313 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "chacha20poly1305.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+inline uint32_t rotateLeft(uint32_t v, int shiftCount)
+{
+    return (v << shiftCount) | (v >> (32 - shiftCount));
+}
+
+inline uint32_t readLittleEndian32(const uint8_t * bytes)
+{
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+inline void writeLittleEndian32(uint8_t * bytes, uint32_t v)
+{
+    bytes[0] = (uint8_t)v;
+    bytes[1] = (uint8_t)(v >> 8);
+    bytes[2] = (uint8_t)(v >> 16);
+    bytes[3] = (uint8_t)(v >> 24);
+}
+
+inline void quarterRound(uint32_t & a, uint32_t & b, uint32_t & c, uint32_t & d)
+{
+    a += b;
+    d = rotateLeft(d ^ a, 16);
+    c += d;
+    b = rotateLeft(b ^ c, 12);
+    a += b;
+    d = rotateLeft(d ^ a, 8);
+    c += d;
+    b = rotateLeft(b ^ c, 7);
+}
+
+/** Poly1305 with 26 bit limbs, based on poly1305-donna
+ */
+class Poly1305 final
+{
+private:
+    uint32_t r[5], h[5], pad[4];
+    uint8_t buffer[16];
+    size_t bufferSize = 0;
+    void processBlock(const uint8_t * block, uint32_t highBit)
+    {
+        const uint32_t s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+        h[0] += (readLittleEndian32(block + 0)) & 0x3FFFFFF;
+        h[1] += (readLittleEndian32(block + 3) >> 2) & 0x3FFFFFF;
+        h[2] += (readLittleEndian32(block + 6) >> 4) & 0x3FFFFFF;
+        h[3] += (readLittleEndian32(block + 9) >> 6) & 0x3FFFFFF;
+        h[4] += (readLittleEndian32(block + 12) >> 8) | highBit;
+        uint64_t d0 = (uint64_t)h[0] * r[0] + (uint64_t)h[1] * s4 + (uint64_t)h[2] * s3 + (uint64_t)h[3] * s2 + (uint64_t)h[4] * s1;
+        uint64_t d1 = (uint64_t)h[0] * r[1] + (uint64_t)h[1] * r[0] + (uint64_t)h[2] * s4 + (uint64_t)h[3] * s3 + (uint64_t)h[4] * s2;
+        uint64_t d2 = (uint64_t)h[0] * r[2] + (uint64_t)h[1] * r[1] + (uint64_t)h[2] * r[0] + (uint64_t)h[3] * s4 + (uint64_t)h[4] * s3;
+        uint64_t d3 = (uint64_t)h[0] * r[3] + (uint64_t)h[1] * r[2] + (uint64_t)h[2] * r[1] + (uint64_t)h[3] * r[0] + (uint64_t)h[4] * s4;
+        uint64_t d4 = (uint64_t)h[0] * r[4] + (uint64_t)h[1] * r[3] + (uint64_t)h[2] * r[2] + (uint64_t)h[3] * r[1] + (uint64_t)h[4] * r[0];
+        uint32_t carry = (uint32_t)(d0 >> 26);
+        h[0] = (uint32_t)d0 & 0x3FFFFFF;
+        d1 += carry;
+        carry = (uint32_t)(d1 >> 26);
+        h[1] = (uint32_t)d1 & 0x3FFFFFF;
+        d2 += carry;
+        carry = (uint32_t)(d2 >> 26);
+        h[2] = (uint32_t)d2 & 0x3FFFFFF;
+        d3 += carry;
+        carry = (uint32_t)(d3 >> 26);
+        h[3] = (uint32_t)d3 & 0x3FFFFFF;
+        d4 += carry;
+        carry = (uint32_t)(d4 >> 26);
+        h[4] = (uint32_t)d4 & 0x3FFFFFF;
+        h[0] += carry * 5;
+        carry = h[0] >> 26;
+        h[0] &= 0x3FFFFFF;
+        h[1] += carry;
+    }
+public:
+    explicit Poly1305(const uint8_t key[32])
+    {
+        r[0] = (readLittleEndian32(key + 0)) & 0x3FFFFFF;
+        r[1] = (readLittleEndian32(key + 3) >> 2) & 0x3FFFF03;
+        r[2] = (readLittleEndian32(key + 6) >> 4) & 0x3FFC0FF;
+        r[3] = (readLittleEndian32(key + 9) >> 6) & 0x3F03FFF;
+        r[4] = (readLittleEndian32(key + 12) >> 8) & 0x00FFFFF;
+        for(int i = 0; i < 5; i++)
+            h[i] = 0;
+        for(int i = 0; i < 4; i++)
+            pad[i] = readLittleEndian32(key + 16 + 4 * i);
+    }
+    void update(const uint8_t * bytes, size_t byteCount)
+    {
+        while(byteCount > 0)
+        {
+            if(bufferSize == 0 && byteCount >= 16)
+            {
+                processBlock(bytes, 1 << 24);
+                bytes += 16;
+                byteCount -= 16;
+                continue;
+            }
+            buffer[bufferSize++] = *bytes++;
+            byteCount--;
+            if(bufferSize == 16)
+            {
+                processBlock(buffer, 1 << 24);
+                bufferSize = 0;
+            }
+        }
+    }
+    void padToBlock()
+    {
+        static const uint8_t zeros[16] = {0};
+        if(bufferSize != 0)
+            update(zeros, 16 - bufferSize);
+    }
+    void finish(uint8_t tag[16])
+    {
+        if(bufferSize != 0)
+        {
+            buffer[bufferSize++] = 1;
+            while(bufferSize < 16)
+                buffer[bufferSize++] = 0;
+            processBlock(buffer, 0);
+            bufferSize = 0;
+        }
+        // fully carry h
+        uint32_t carry = h[1] >> 26;
+        h[1] &= 0x3FFFFFF;
+        for(int i = 2; i < 5; i++)
+        {
+            h[i] += carry;
+            carry = h[i] >> 26;
+            h[i] &= 0x3FFFFFF;
+        }
+        h[0] += carry * 5;
+        carry = h[0] >> 26;
+        h[0] &= 0x3FFFFFF;
+        h[1] += carry;
+        // compute h - p and select it if h >= p
+        uint32_t g[5];
+        g[0] = h[0] + 5;
+        carry = g[0] >> 26;
+        g[0] &= 0x3FFFFFF;
+        for(int i = 1; i < 4; i++)
+        {
+            g[i] = h[i] + carry;
+            carry = g[i] >> 26;
+            g[i] &= 0x3FFFFFF;
+        }
+        g[4] = h[4] + carry - (1 << 26);
+        uint32_t mask = (g[4] >> 31) - 1;
+        for(int i = 0; i < 5; i++)
+            h[i] = (h[i] & ~mask) | (g[i] & mask);
+        // h = (h + pad) % 2^128
+        uint32_t words[4];
+        words[0] = h[0] | (h[1] << 26);
+        words[1] = (h[1] >> 6) | (h[2] << 20);
+        words[2] = (h[2] >> 12) | (h[3] << 14);
+        words[3] = (h[3] >> 18) | (h[4] << 8);
+        uint64_t sum = 0;
+        for(int i = 0; i < 4; i++)
+        {
+            sum = (uint64_t)words[i] + pad[i] + (sum >> 32);
+            writeLittleEndian32(tag + 4 * i, (uint32_t)sum);
+        }
+    }
+    ~Poly1305()
+    {
+        for(int i = 0; i < 5; i++)
+            r[i] = h[i] = 0;
+        for(int i = 0; i < 4; i++)
+            pad[i] = 0;
+    }
+};
+}
+
+ChaCha20Poly1305::ChaCha20Poly1305(const uint8_t key[KeySize], const uint8_t nonce[NonceSize])
+{
+    for(size_t i = 0; i < KeySize / 4; i++)
+        keyWords[i] = readLittleEndian32(key + 4 * i);
+    for(size_t i = 0; i < NonceSize / 4; i++)
+        nonceWords[i] = readLittleEndian32(nonce + 4 * i);
+}
+
+ChaCha20Poly1305::~ChaCha20Poly1305()
+{
+    volatile uint32_t * pkeyWords = keyWords;
+    for(size_t i = 0; i < KeySize / 4; i++)
+        pkeyWords[i] = 0;
+}
+
+void ChaCha20Poly1305::keyStreamBlock(uint32_t counter, uint8_t output[64]) const
+{
+    uint32_t state[16] =
+    {
+        0x61707865, 0x3320646E, 0x79622D32, 0x6B206574,
+        keyWords[0], keyWords[1], keyWords[2], keyWords[3],
+        keyWords[4], keyWords[5], keyWords[6], keyWords[7],
+        counter, nonceWords[0], nonceWords[1], nonceWords[2]
+    };
+    uint32_t x[16];
+    for(int i = 0; i < 16; i++)
+        x[i] = state[i];
+    for(int i = 0; i < 10; i++)
+    {
+        quarterRound(x[0], x[4], x[8], x[12]);
+        quarterRound(x[1], x[5], x[9], x[13]);
+        quarterRound(x[2], x[6], x[10], x[14]);
+        quarterRound(x[3], x[7], x[11], x[15]);
+        quarterRound(x[0], x[5], x[10], x[15]);
+        quarterRound(x[1], x[6], x[11], x[12]);
+        quarterRound(x[2], x[7], x[8], x[13]);
+        quarterRound(x[3], x[4], x[9], x[14]);
+    }
+    for(int i = 0; i < 16; i++)
+        writeLittleEndian32(output + 4 * i, x[i] + state[i]);
+}
+
+void ChaCha20Poly1305::crypt(uint8_t * text, size_t size, uint64_t offset) const
+{
+    uint8_t block[64];
+    uint32_t counter = 1 + offset / sizeof(block); // block 0 is used for the Poly1305 key
+    for(size_t location = 0; location < size; location += sizeof(block), counter++)
+    {
+        keyStreamBlock(counter, block);
+        size_t blockSize = min(sizeof(block), size - location);
+        for(size_t i = 0; i < blockSize; i++)
+            text[location + i] ^= block[i];
+    }
+}
+
+void ChaCha20Poly1305::computeTag(const string & aad, const function<size_t(uint8_t *, size_t)> & readCipherText, uint8_t tag[TagSize]) const
+{
+    uint8_t block[64];
+    keyStreamBlock(0, block);
+    Poly1305 mac(block);
+    mac.update((const uint8_t *)aad.data(), aad.size());
+    mac.padToBlock();
+    uint64_t cipherTextSize = 0;
+    uint8_t buffer[4096];
+    for(size_t readCount; (readCount = readCipherText(buffer, sizeof(buffer))) > 0; cipherTextSize += readCount)
+        mac.update(buffer, readCount);
+    mac.padToBlock();
+    uint8_t lengths[16];
+    writeLittleEndian32(lengths + 0, (uint32_t)aad.size());
+    writeLittleEndian32(lengths + 4, (uint32_t)((uint64_t)aad.size() >> 32));
+    writeLittleEndian32(lengths + 8, (uint32_t)cipherTextSize);
+    writeLittleEndian32(lengths + 12, (uint32_t)(cipherTextSize >> 32));
+    mac.update(lengths, sizeof(lengths));
+    mac.finish(tag);
+}
+
+namespace
+{
+/** @return a function reading str in parts, for computeTag */
+function<size_t(uint8_t *, size_t)> makeStringReader(const string & str)
+{
+    size_t location = 0;
+    return [&str, location](uint8_t * buffer, size_t size) mutable
+    {
+        size_t readCount = min(size, str.size() - location);
+        copy(str.begin() + location, str.begin() + location + readCount, buffer);
+        location += readCount;
+        return readCount;
+    };
+}
+}
+
+void ChaCha20Poly1305::encrypt(string & plainText, uint8_t tag[TagSize], const string & aad) const
+{
+    crypt((uint8_t *)&plainText[0], plainText.size(), 0);
+    computeTag(aad, makeStringReader(plainText), tag);
+}
+
+void ChaCha20Poly1305::decrypt(string & cipherText, const uint8_t tag[TagSize], const string & aad) const
+{
+    verify(makeStringReader(cipherText), tag, aad);
+    crypt((uint8_t *)&cipherText[0], cipherText.size(), 0);
+}
+
+void ChaCha20Poly1305::verify(const function<size_t(uint8_t *, size_t)> & readCipherText, const uint8_t tag[TagSize], const string & aad) const
+{
+    uint8_t expectedTag[TagSize];
+    computeTag(aad, readCipherText, expectedTag);
+    uint8_t difference = 0;
+    for(size_t i = 0; i < TagSize; i++)
+        difference |= expectedTag[i] ^ tag[i];
+    if(difference != 0)
+        throw AuthenticationException();
+}
+
+void ChaCha20Poly1305::decryptPart(uint8_t * text, size_t size, uint64_t offset) const
+{
+    crypt(text, size, offset);
+}
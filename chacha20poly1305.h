@@ -0,0 +1,72 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef CHACHA20POLY1305_H_INCLUDED
+#define CHACHA20POLY1305_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <stdexcept>
+#include <functional>
+
+using namespace std;
+
+class AuthenticationException final : public runtime_error
+{
+public:
+    explicit AuthenticationException()
+        : runtime_error("authentication tag doesn't match")
+    {
+    }
+};
+
+/** ChaCha20-Poly1305 AEAD as specified in RFC 8439
+ */
+class ChaCha20Poly1305 final
+{
+public:
+    static constexpr size_t KeySize = 32;
+    static constexpr size_t NonceSize = 12;
+    static constexpr size_t TagSize = 16;
+private:
+    uint32_t keyWords[KeySize / 4];
+    uint32_t nonceWords[NonceSize / 4];
+    void keyStreamBlock(uint32_t counter, uint8_t output[64]) const;
+    void crypt(uint8_t * text, size_t size, uint64_t offset) const;
+    void computeTag(const string & aad, const function<size_t(uint8_t *, size_t)> & readCipherText, uint8_t tag[TagSize]) const;
+public:
+    ChaCha20Poly1305(const uint8_t key[KeySize], const uint8_t nonce[NonceSize]);
+    ~ChaCha20Poly1305();
+    /** encrypts plainText in place and writes the authentication tag to tag
+     */
+    void encrypt(string & plainText, uint8_t tag[TagSize], const string & aad = "") const;
+    /** checks the authentication tag then decrypts cipherText in place
+     * @throw AuthenticationException if the tag doesn't match
+     */
+    void decrypt(string & cipherText, const uint8_t tag[TagSize], const string & aad = "") const;
+    /** checks the authentication tag of a cipher text too large to hold, which is read in parts
+     * @param readCipherText fills its buffer with up to the given number of bytes and returns how many, 0 at the end
+     * @throw AuthenticationException if the tag doesn't match
+     */
+    void verify(const function<size_t(uint8_t *, size_t)> & readCipherText, const uint8_t tag[TagSize], const string & aad = "") const;
+    /** decrypts part of a cipher text in place, without checking the tag
+     * @param offset where the part starts in the cipher text, a multiple of 64
+     */
+    void decryptPart(uint8_t * text, size_t size, uint64_t offset) const;
+};
+
+#endif // CHACHA20POLY1305_H_INCLUDED
@@ -0,0 +1,47 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "checksum.h"
+
+namespace
+{
+struct CRC32Table
+{
+    uint32_t table[256];
+    CRC32Table()
+    {
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t v = i;
+            for(int j = 0; j < 8; j++)
+                v = (v & 1) ? (v >> 1) ^ 0xEDB88320 : v >> 1;
+            table[i] = v;
+        }
+    }
+};
+
+const CRC32Table crc32Table;
+}
+
+uint32_t crc32(const void * data, size_t size, uint32_t crc)
+{
+    const uint8_t * bytes = (const uint8_t *)data;
+    crc = ~crc;
+    for(size_t i = 0; i < size; i++)
+        crc = crc32Table.table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
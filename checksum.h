@@ -0,0 +1,28 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef CHECKSUM_H_INCLUDED
+#define CHECKSUM_H_INCLUDED
+
+#include <cstdint>
+#include <cstddef>
+
+/** CRC-32 (IEEE 802.3), pass the previous return value as crc to continue a checksum
+ */
+uint32_t crc32(const void * data, size_t size, uint32_t crc = 0);
+
+#endif // CHECKSUM_H_INCLUDED
@@ -0,0 +1,225 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "eventcolumns.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <climits>
+#include <cctype>
+#include <ctime>
+
+using namespace std;
+
+namespace
+{
+/** parses a time written by appendTime, either seconds since the epoch or "%c" in local time
+ * @return false if str isn't a time
+ */
+bool parseTime(const string & str, int64_t & t)
+{
+    if(!str.empty() && str.find_first_not_of("-0123456789") == string::npos)
+    {
+        t = atoll(str.c_str());
+        return true;
+    }
+    tm brokenDownTime = {};
+    const char * end = strptime(str.c_str(), "%c", &brokenDownTime);
+    if(end == nullptr || *end != '\0')
+        return false;
+    brokenDownTime.tm_isdst = -1;
+    t = mktime(&brokenDownTime);
+    return true;
+}
+
+/** converts the "Event : " lines of a text log, the receive times aren't in the log so they're left unknown */
+int convertLog(const string & logFileName, const string & directory, size_t blockRowCount, size_t blocksPerFile)
+{
+    ifstream is(logFileName.c_str());
+    if(!is)
+        throw runtime_error("can't open " + logFileName);
+    const string prefix = "Event : ", separator = " : ";
+    vector<EventColumnRows> blocks(1);
+    size_t eventCount = 0, skippedCount = 0, fileCount = 0;
+    auto flush = [&]()
+    {
+        if(blocks.back().size() == 0)
+            blocks.pop_back();
+        if(blocks.empty())
+            return;
+        cout << EventColumnWriter::writeFile(directory, blocks) << "\n";
+        fileCount++;
+        blocks.assign(1, EventColumnRows());
+    };
+    string line;
+    while(getline(is, line))
+    {
+        if(line.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        size_t nameEnd = line.find(separator, prefix.size());
+        size_t timeEnd = nameEnd == string::npos ? string::npos : line.find(separator, nameEnd + separator.size());
+        int64_t deviceTime;
+        if(timeEnd == string::npos || !parseTime(line.substr(nameEnd + separator.size(), timeEnd - nameEnd - separator.size()), deviceTime))
+        {
+            skippedCount++;
+            continue;
+        }
+        EventColumnRows & rows = blocks.back();
+        rows.deviceNames.push_back(line.substr(prefix.size(), nameEnd - prefix.size()));
+        rows.deviceTimes.push_back(deviceTime);
+        rows.receiveTimes.push_back(0);
+        rows.texts.push_back(line.substr(timeEnd + separator.size()));
+        eventCount++;
+        if(rows.size() >= blockRowCount)
+        {
+            if(blocks.size() >= blocksPerFile)
+                flush();
+            else
+                blocks.emplace_back();
+        }
+    }
+    flush();
+    cerr << "converted " << eventCount << " events into " << fileCount << " files";
+    if(skippedCount > 0)
+        cerr << ", skipped " << skippedCount << " unparsable lines";
+    cerr << endl;
+    return 0;
+}
+
+/** prints the selected columns of the rows whose device time is in [startTime, endTime], reading only those columns
+ * and the device time column and skipping the blocks whose stats are outside the range
+ */
+int scanFile(const string & fileName, const string & columnList, int64_t startTime, int64_t endTime)
+{
+    EventColumnFile file(fileName);
+    vector<size_t> selected;
+    istringstream columnNames(columnList);
+    string name;
+    while(getline(columnNames, name, ','))
+    {
+        size_t column = file.findColumn(name);
+        if(column == file.getColumnCount())
+            throw runtime_error("no column " + name + " in " + fileName);
+        selected.push_back(column);
+    }
+    size_t timeColumn = file.findColumn("device-time");
+    if(timeColumn == file.getColumnCount())
+        throw runtime_error("no device-time column in " + fileName);
+    bool useTimeFilter = startTime != LLONG_MIN || endTime != LLONG_MAX;
+    size_t skippedBlockCount = 0;
+    vector<int64_t> times;
+    vector<vector<int64_t>> timeValues(selected.size());
+    vector<vector<string>> dictionaries(selected.size());
+    vector<vector<uint32_t>> codes(selected.size());
+    string line;
+    for(size_t block = 0; block < file.getBlockCount(); block++)
+    {
+        if(useTimeFilter && (file.getMaxTime(block, timeColumn) < startTime || file.getMinTime(block, timeColumn) > endTime))
+        {
+            skippedBlockCount++;
+            continue;
+        }
+        if(useTimeFilter)
+            file.readTimes(block, timeColumn, times);
+        for(size_t i = 0; i < selected.size(); i++)
+        {
+            if(file.getColumnType(selected[i]) == EventColumnType::Time)
+                file.readTimes(block, selected[i], timeValues[i]);
+            else
+                file.readStrings(block, selected[i], dictionaries[i], codes[i]);
+        }
+        for(size_t row = 0; row < file.getRowCount(block); row++)
+        {
+            if(useTimeFilter && (times[row] < startTime || times[row] > endTime))
+                continue;
+            line.clear();
+            for(size_t i = 0; i < selected.size(); i++)
+            {
+                if(i > 0)
+                    line += " : ";
+                if(file.getColumnType(selected[i]) == EventColumnType::Time)
+                    line += to_string((long long)timeValues[i][row]);
+                else
+                    line += dictionaries[i][codes[i][row]];
+            }
+            line += "\n";
+            cout << line;
+        }
+    }
+    if(useTimeFilter)
+        cerr << "skipped " << skippedBlockCount << " of " << file.getBlockCount() << " blocks" << endl;
+    return 0;
+}
+}
+
+int main(int argc, char ** argv)
+{
+    const char * defaultColumns = "device,device-time,text";
+    if(argc >= 2 && string(argv[1]) == "--from-log")
+    {
+        if(argc != 4 && argc != 6)
+        {
+            cerr << "usage : " << argv[0] << " --from-log <log file> <output directory> [<block rows> <blocks per file>]\n";
+            return 1;
+        }
+        size_t blockRowCount = 65536, blocksPerFile = 16;
+        if(argc == 6)
+        {
+            blockRowCount = max(atoll(argv[4]), 1LL);
+            blocksPerFile = max(atoll(argv[5]), 1LL);
+        }
+        try
+        {
+            return convertLog(argv[2], argv[3], blockRowCount, blocksPerFile);
+        }
+        catch(exception & e)
+        {
+            cerr << "Error : " << e.what() << endl;
+            return 1;
+        }
+    }
+    string columnList = defaultColumns;
+    int argIndex = 2;
+    if(argc >= 4 && string(argv[2]) == "--columns")
+    {
+        columnList = argv[3];
+        argIndex = 4;
+    }
+    if(argc < 2 || (argc - argIndex != 0 && argc - argIndex != 2))
+    {
+        cerr << "usage : " << argv[0] << " <columnar file> [--columns <column>,...] [<start time> <end time>]\n";
+        cerr << "        " << argv[0] << " --from-log <log file> <output directory> [<block rows> <blocks per file>]\n";
+        cerr << "columns are device, device-time, receive-time and text, the default is " << defaultColumns << "\n";
+        return 1;
+    }
+    int64_t startTime = LLONG_MIN, endTime = LLONG_MAX;
+    if(argc - argIndex == 2)
+    {
+        startTime = atoll(argv[argIndex]);
+        endTime = atoll(argv[argIndex + 1]);
+    }
+    try
+    {
+        return scanFile(argv[1], columnList, startTime, endTime);
+    }
+    catch(exception & e)
+    {
+        cerr << "Error : " << e.what() << endl;
+        return 1;
+    }
+}
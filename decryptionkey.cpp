@@ -0,0 +1,183 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "decryptionkey.h"
+#include "stream.h"
+#include <fstream>
+#include <thread>
+#include <cerrno>
+#include <csignal>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace
+{
+shared_ptr<const KeyRing> currentKeyRing;
+
+/** identifies a version of the key file, so polling can tell when it's replaced */
+struct FileVersion
+{
+    bool exists = false;
+    ino_t inode = 0;
+    off_t size = 0;
+    time_t modificationTime = 0;
+    long modificationNanoseconds = 0;
+    bool operator ==(const FileVersion & rt) const
+    {
+        return exists == rt.exists && inode == rt.inode && size == rt.size && modificationTime == rt.modificationTime && modificationNanoseconds == rt.modificationNanoseconds;
+    }
+};
+
+FileVersion getFileVersion(const string & fileName)
+{
+    FileVersion retval;
+    struct stat st;
+    if(stat(fileName.c_str(), &st) != 0)
+        return retval;
+    retval.exists = true;
+    retval.inode = st.st_ino;
+    retval.size = st.st_size;
+    retval.modificationTime = st.st_mtim.tv_sec;
+    retval.modificationNanoseconds = st.st_mtim.tv_nsec;
+    return retval;
+}
+
+void reloadKeyRing(const string & fileName)
+{
+    try
+    {
+        shared_ptr<const KeyRing> keyRing = loadKeyRing(fileName);
+        setKeyRing(keyRing);
+        cout << "loaded " << keyRing->getKeys().size() << " decryption key(s) from " << fileName << endl;
+    }
+    catch(exception & e)
+    {
+        cerr << "Error : " << e.what() << " : keeping the current keys" << endl;
+    }
+}
+}
+
+KeyRing::KeyRing(vector<shared_ptr<const DecryptionKey>> keys)
+    : keys(keys)
+{
+}
+
+shared_ptr<const DecryptionKey> KeyRing::find(uint32_t id) const
+{
+    for(const shared_ptr<const DecryptionKey> & key : keys)
+        if(key->id == id)
+            return key;
+    return nullptr;
+}
+
+shared_ptr<const DecryptionKey> KeyRing::findByTrial(const BigUnsigned & cipherText, string & plainText, size_t blockSize) const
+{
+    for(const shared_ptr<const DecryptionKey> & key : keys)
+    {
+        if((blockSize != 0 && key->blockSize != blockSize) || cipherText >= key->modulus)
+            continue;
+        try
+        {
+            plainText = decryptBlock(cipherText, key->exponent, key->modulus);
+            return key;
+        }
+        catch(exception & e)
+        {
+        }
+    }
+    return nullptr;
+}
+
+shared_ptr<const KeyRing> loadKeyRing(string fileName)
+{
+    ifstream is(fileName.c_str());
+    if(!is)
+        throw IOException("IO Error : can't open " + fileName);
+    vector<shared_ptr<const DecryptionKey>> keys;
+    string modulus, exponent;
+    while(is >> modulus)
+    {
+        if(!(is >> exponent))
+            throw IOException("IO Error : can't load key from " + fileName + " : missing exponent");
+        shared_ptr<const DecryptionKey> key;
+        try
+        {
+            key = make_shared<const DecryptionKey>(BigUnsigned::parseHexByteString(modulus), BigUnsigned::parseHexByteString(exponent));
+        }
+        catch(exception & e)
+        {
+            throw IOException("IO Error : can't load key from " + fileName + " : " + e.what());
+        }
+        for(const shared_ptr<const DecryptionKey> & other : keys)
+            if(other->id == key->id)
+                throw IOException("IO Error : can't load key from " + fileName + " : duplicate key id " + to_string(key->id));
+        keys.push_back(key);
+    }
+    if(keys.empty())
+        throw IOException("IO Error : can't load key from " + fileName + " : missing modulus or exponent");
+    return make_shared<const KeyRing>(keys);
+}
+
+shared_ptr<const KeyRing> getKeyRing()
+{
+    return atomic_load(&currentKeyRing);
+}
+
+void setKeyRing(shared_ptr<const KeyRing> keyRing)
+{
+    atomic_store(&currentKeyRing, keyRing);
+}
+
+void startKeyRingReloader(string fileName, chrono::seconds watchInterval)
+{
+    sigset_t signals, allSignals, oldSignals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    // the reloader thread starts with all signals blocked so it only gets the ones it waits for
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_SETMASK, &allSignals, &oldSignals);
+    thread([fileName, watchInterval, signals]()
+    {
+        FileVersion version = getFileVersion(fileName);
+        for(;;)
+        {
+            if(watchInterval.count() > 0)
+            {
+                timespec timeout = {(time_t)watchInterval.count(), 0};
+                if(sigtimedwait(&signals, nullptr, &timeout) == -1)
+                {
+                    if(errno != EAGAIN)
+                        continue; // interrupted
+                    FileVersion newVersion = getFileVersion(fileName);
+                    if(newVersion == version || !newVersion.exists)
+                        continue;
+                }
+            }
+            else
+            {
+                int signal;
+                if(sigwait(&signals, &signal) != 0)
+                    continue;
+            }
+            version = getFileVersion(fileName);
+            reloadKeyRing(fileName);
+        }
+    }).detach();
+    sigaddset(&oldSignals, SIGHUP);
+    pthread_sigmask(SIG_SETMASK, &oldSignals, nullptr);
+}
@@ -0,0 +1,86 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef DECRYPTIONKEY_H_INCLUDED
+#define DECRYPTIONKEY_H_INCLUDED
+
+#include "bigmath.h"
+#include "blockcrypt.h"
+#include <memory>
+#include <string>
+#include <chrono>
+#include <vector>
+
+using namespace std;
+
+/** a private key with everything derived from it, immutable once published */
+struct DecryptionKey
+{
+    BigUnsigned modulus;
+    BigUnsigned exponent;
+    size_t blockSize; // bytes per ciphertext block in binary requests
+    uint32_t id; // sent by clients in keyed requests, see getKeyId
+    DecryptionKey(BigUnsigned modulus, BigUnsigned exponent)
+        : modulus(modulus), exponent(exponent), blockSize(modulus.byteCount()), id(getKeyId(modulus))
+    {
+    }
+};
+
+/** the keys requests are accepted with, immutable once published.
+ * Keyed requests name their key by id, so they need one powMod per block however many keys there are.
+ * Other encrypted requests fall back to trying each key on their first block until the check sum matches.
+ */
+class KeyRing final
+{
+private:
+    vector<shared_ptr<const DecryptionKey>> keys;
+public:
+    explicit KeyRing(vector<shared_ptr<const DecryptionKey>> keys);
+    /** @return the keys, in the order they're tried in */
+    const vector<shared_ptr<const DecryptionKey>> & getKeys() const
+    {
+        return keys;
+    }
+    /** @return the key with id, or null if there isn't one */
+    shared_ptr<const DecryptionKey> find(uint32_t id) const;
+    /** @return the first key that decrypts cipherText with a matching check sum, or null if there isn't one
+     * @param plainText set to the decrypted block
+     * @param blockSize if not 0 only keys with this block size are tried
+     */
+    shared_ptr<const DecryptionKey> findByTrial(const BigUnsigned & cipherText, string & plainText, size_t blockSize = 0) const;
+};
+
+/** @return the key ring loaded from fileName, which holds the hex modulus and exponent of each key, one key after another
+ * @throw IOException if the file can't be read or parsed or has no keys
+ */
+shared_ptr<const KeyRing> loadKeyRing(string fileName);
+
+/** @return the current key ring, or null if unencrypted requests are accepted.
+ * Requests keep the returned pointer until they finish, so replaced keys are freed after the last request using them.
+ */
+shared_ptr<const KeyRing> getKeyRing();
+
+/** atomically replaces the current key ring, requests that already got the old one keep using it */
+void setKeyRing(shared_ptr<const KeyRing> keyRing);
+
+/** starts a thread that loads fileName again whenever SIGHUP is received, or when the file changes if watchInterval isn't 0.
+ * A key ring that fails to load is reported and the current one is kept.
+ * Has to be called before any other threads are started, as SIGHUP is blocked to be received with sigwait.
+ */
+void startKeyRingReloader(string fileName, chrono::seconds watchInterval);
+
+#endif // DECRYPTIONKEY_H_INCLUDED
@@ -0,0 +1,236 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "deviceregistry.h"
+#include "stream.h"
+#include "checksum.h"
+#include "binaryio.h"
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+const char fileMagic[8] = {'P', 'C', 'D', 'E', 'V', 'R', 'G', '\0'};
+}
+
+size_t DeviceRegistry::NameRefHash::operator ()(const NameRef & name) const
+{
+    uint64_t retval = 0xCBF29CE484222325ULL; // FNV-1a
+    for(size_t i = 0; i < name.size; i++)
+    {
+        retval ^= (uint8_t)name.data[i];
+        retval *= 0x100000001B3ULL;
+    }
+    return retval;
+}
+
+DeviceRegistry::DeviceRegistry(string fileName, chrono::seconds flushInterval)
+    : fileName(fileName), flushInterval(flushInterval)
+{
+    if(fileName == "")
+        return;
+    load();
+    flushThread = thread(&DeviceRegistry::flushFn, this);
+}
+
+DeviceRegistry::~DeviceRegistry()
+{
+    if(!flushThread.joinable())
+        return;
+    flushLock.lock();
+    done = true;
+    flushCond.notify_all();
+    flushLock.unlock();
+    flushThread.join();
+    try
+    {
+        flush();
+    }
+    catch(exception & e)
+    {
+        cerr << "Error : " << e.what() << endl;
+    }
+}
+
+const char * DeviceRegistry::storeName(const char * data, size_t size)
+{
+    if(size > ArenaBlockSize / 4)
+    {
+        // large names get their own block, in front so the partly used block stays last
+        arenaBlocks.insert(arenaBlocks.begin(), unique_ptr<char[]>(new char[size]));
+        memcpy(arenaBlocks.front().get(), data, size);
+        return arenaBlocks.front().get();
+    }
+    if(arenaBlocks.empty() || ArenaBlockSize - arenaBlockUsed < size)
+    {
+        arenaBlocks.push_back(unique_ptr<char[]>(new char[ArenaBlockSize]));
+        arenaBlockUsed = 0;
+    }
+    char * retval = arenaBlocks.back().get() + arenaBlockUsed;
+    memcpy(retval, data, size);
+    arenaBlockUsed += size;
+    return retval;
+}
+
+uint32_t DeviceRegistry::internLocked(const char * data, size_t size)
+{
+    NameRef name = {data, size};
+    auto iter = ids.find(name);
+    if(iter != ids.end())
+        return get<1>(*iter);
+    uint32_t retval = names.size();
+    name.data = storeName(data, size);
+    names.push_back(name);
+    infos.push_back(DeviceInfo());
+    ids[name] = retval;
+    return retval;
+}
+
+uint32_t DeviceRegistry::intern(const string & deviceName)
+{
+    if(deviceName.size() > MaxNameSize)
+        throw runtime_error("device name longer than " + to_string(MaxNameSize) + " bytes");
+    lock_guard<mutex> lockIt(lock);
+    return internLocked(deviceName.data(), deviceName.size());
+}
+
+string DeviceRegistry::getName(uint32_t deviceId) const
+{
+    lock_guard<mutex> lockIt(lock);
+    if(deviceId >= names.size())
+        return "";
+    return string(names[deviceId].data, names[deviceId].size);
+}
+
+size_t DeviceRegistry::size() const
+{
+    lock_guard<mutex> lockIt(lock);
+    return names.size();
+}
+
+void DeviceRegistry::recordSync(uint32_t deviceId, time_t syncTime, uint64_t eventCount, uint64_t byteCount)
+{
+    lock_guard<mutex> lockIt(lock);
+    if(deviceId >= infos.size())
+        return;
+    DeviceInfo & info = infos[deviceId];
+    info.lastSyncTime = max(info.lastSyncTime, syncTime);
+    info.syncCount++;
+    info.eventCount += eventCount;
+    info.byteCount += byteCount;
+}
+
+DeviceInfo DeviceRegistry::getInfo(uint32_t deviceId) const
+{
+    lock_guard<mutex> lockIt(lock);
+    if(deviceId >= infos.size())
+        return DeviceInfo();
+    return infos[deviceId];
+}
+
+void DeviceRegistry::flush()
+{
+    if(fileName == "")
+        return;
+    string buffer(fileMagic, sizeof(fileMagic));
+    {
+        lock_guard<mutex> lockIt(lock);
+        appendLittleEndian(buffer, names.size(), 4);
+        for(size_t i = 0; i < names.size(); i++)
+        {
+            appendLittleEndian(buffer, names[i].size, 2);
+            buffer.append(names[i].data, names[i].size);
+            appendLittleEndian(buffer, (uint64_t)(int64_t)infos[i].lastSyncTime, 8);
+            appendLittleEndian(buffer, infos[i].syncCount, 8);
+            appendLittleEndian(buffer, infos[i].eventCount, 8);
+            appendLittleEndian(buffer, infos[i].byteCount, 8);
+        }
+    }
+    appendLittleEndian(buffer, crc32(buffer.data(), buffer.size()), 4);
+    string tempFileName = fileName + ".tmp";
+    FILE * f = fopen(tempFileName.c_str(), "wb");
+    if(f == nullptr)
+        throw IOException("IO Error : can't create " + tempFileName + " : " + strerror(errno));
+    bool failed = (fwrite(buffer.data(), 1, buffer.size(), f) != buffer.size());
+    if(fclose(f) != 0 || failed)
+        throw IOException("IO Error : can't write to " + tempFileName);
+    if(rename(tempFileName.c_str(), fileName.c_str()) == -1)
+        throw IOException("IO Error : can't rename " + tempFileName + " : " + strerror(errno));
+}
+
+void DeviceRegistry::load()
+{
+    ifstream is(fileName.c_str(), ios::binary);
+    if(!is)
+        return; // nothing saved yet
+    string contents((istreambuf_iterator<char>(is)), istreambuf_iterator<char>());
+    const uint8_t * bytes = (const uint8_t *)contents.data();
+    size_t location = sizeof(fileMagic);
+    auto need = [&](size_t byteCount)
+    {
+        if(contents.size() - location < byteCount)
+            throw IOException("IO Error : invalid device registry " + fileName);
+    };
+    if(contents.size() < sizeof(fileMagic) + 4 || memcmp(bytes, fileMagic, sizeof(fileMagic)) != 0
+       || crc32(bytes, contents.size() - 4) != readLittleEndian(bytes + contents.size() - 4, 4))
+        throw IOException("IO Error : invalid device registry " + fileName);
+    contents.resize(contents.size() - 4);
+    need(4);
+    size_t deviceCount = readLittleEndian(bytes + location, 4);
+    location += 4;
+    for(size_t i = 0; i < deviceCount; i++)
+    {
+        need(2);
+        size_t size = readLittleEndian(bytes + location, 2);
+        location += 2;
+        need(size + 32);
+        uint32_t deviceId = internLocked((const char *)bytes + location, size);
+        location += size;
+        DeviceInfo & info = infos[deviceId];
+        info.lastSyncTime = (time_t)(int64_t)readLittleEndian(bytes + location, 8);
+        info.syncCount = readLittleEndian(bytes + location + 8, 8);
+        info.eventCount = readLittleEndian(bytes + location + 16, 8);
+        info.byteCount = readLittleEndian(bytes + location + 24, 8);
+        location += 32;
+    }
+}
+
+void DeviceRegistry::flushFn()
+{
+    unique_lock<mutex> lockIt(flushLock);
+    while(!done)
+    {
+        flushCond.wait_for(lockIt, flushInterval);
+        if(done)
+            break;
+        lockIt.unlock();
+        try
+        {
+            flush();
+        }
+        catch(exception & e)
+        {
+            cerr << "Error : " << e.what() << endl;
+        }
+        lockIt.lock();
+    }
+}
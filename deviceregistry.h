@@ -0,0 +1,105 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef DEVICEREGISTRY_H_INCLUDED
+#define DEVICEREGISTRY_H_INCLUDED
+
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <ctime>
+#include <cstring>
+#include <cstdint>
+
+using namespace std;
+
+/** what is known about a device from its accepted requests */
+struct DeviceInfo
+{
+    time_t lastSyncTime = 0;
+    uint64_t syncCount = 0;
+    uint64_t eventCount = 0;
+    uint64_t byteCount = 0; // event text bytes
+};
+
+/** interns device names to dense ids and keeps per device metadata.
+ * Names are stored once in an arena, lookups don't allocate.
+ * The registry is periodically written to a file, which is loaded again at startup so ids stay the same.
+ *
+ * file layout (little endian) : "PCDEVRG" + NUL, u32 device count,
+ *   devices in id order (u16 length + name, i64 last sync time, u64 sync count, u64 event count, u64 byte count),
+ *   u32 CRC-32 of everything before it
+ */
+class DeviceRegistry final
+{
+    DeviceRegistry(const DeviceRegistry &) = delete;
+    const DeviceRegistry & operator =(const DeviceRegistry &) = delete;
+private:
+    struct NameRef
+    {
+        const char * data;
+        size_t size;
+        bool operator ==(const NameRef & rt) const
+        {
+            return size == rt.size && memcmp(data, rt.data, size) == 0;
+        }
+    };
+    struct NameRefHash
+    {
+        size_t operator ()(const NameRef & name) const;
+    };
+    static const size_t ArenaBlockSize = 1 << 14;
+    mutable mutex lock;
+    vector<unique_ptr<char[]>> arenaBlocks;
+    size_t arenaBlockUsed = ArenaBlockSize;
+    unordered_map<NameRef, uint32_t, NameRefHash> ids;
+    vector<NameRef> names;
+    vector<DeviceInfo> infos;
+    const string fileName;
+    const chrono::seconds flushInterval;
+    mutex flushLock;
+    condition_variable flushCond;
+    bool done = false;
+    thread flushThread;
+    const char * storeName(const char * data, size_t size);
+    uint32_t internLocked(const char * data, size_t size);
+    void load();
+    void flushFn();
+public:
+    /** @param fileName where the registry is written, no file is used if it's empty */
+    DeviceRegistry(string fileName, chrono::seconds flushInterval);
+    ~DeviceRegistry();
+    static const size_t MaxNameSize = 0xFFFF; // the most the file's u16 name length can hold
+    /** @return the id of deviceName, adding it if it's new
+     * @throw runtime_error if deviceName is longer than MaxNameSize, as it couldn't be written to the file
+     */
+    uint32_t intern(const string & deviceName);
+    /** @return the name of the device with id deviceId */
+    string getName(uint32_t deviceId) const;
+    /** @return the number of devices, ids are less than this */
+    size_t size() const;
+    void recordSync(uint32_t deviceId, time_t syncTime, uint64_t eventCount, uint64_t byteCount);
+    DeviceInfo getInfo(uint32_t deviceId) const;
+    void flush();
+};
+
+#endif // DEVICEREGISTRY_H_INCLUDED
@@ -0,0 +1,637 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "eventcolumns.h"
+#include "stream.h"
+#include "checksum.h"
+#include "binaryio.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+namespace
+{
+const char headerMagic[8] = {'P', 'C', 'C', 'O', 'L', 'E', 'V', '\0'};
+const char footerMagic[8] = {'P', 'C', 'C', 'O', 'L', 'F', 'T', '\0'};
+const size_t headerSize = sizeof(headerMagic) + 4;
+const size_t trailerSize = 4 + 8 + sizeof(footerMagic);
+const size_t columnCount = 4;
+const char * const columnNames[columnCount] = {"device", "device-time", "receive-time", "text"};
+const EventColumnType columnTypes[columnCount] = {EventColumnType::String, EventColumnType::Time, EventColumnType::Time, EventColumnType::String};
+const size_t blockHeaderSize = 4 + 4 * columnCount + 4;
+const string pendingSuffix = ".pending";
+
+void appendString(string & buffer, const string & str)
+{
+    appendLittleEndian(buffer, str.size(), 4);
+    buffer += str;
+}
+
+void encodeStrings(const vector<string> & values, string & chunk, string & stats)
+{
+    unordered_map<string, uint32_t> codes;
+    vector<const string *> dictionary;
+    string codeBytes;
+    for(const string & value : values)
+    {
+        auto iter = codes.find(value);
+        uint32_t code;
+        if(iter == codes.end())
+        {
+            code = dictionary.size();
+            codes.emplace(value, code);
+            dictionary.push_back(&value);
+        }
+        else
+            code = iter->second;
+        appendLittleEndian(codeBytes, code, 4);
+    }
+    appendLittleEndian(chunk, dictionary.size(), 4);
+    const string * minValue = nullptr, * maxValue = nullptr;
+    for(const string * value : dictionary)
+    {
+        appendString(chunk, *value);
+        if(!minValue || *value < *minValue)
+            minValue = value;
+        if(!maxValue || *value > *maxValue)
+            maxValue = value;
+    }
+    chunk += codeBytes;
+    appendString(stats, minValue ? *minValue : string());
+    appendString(stats, maxValue ? *maxValue : string());
+}
+
+void encodeTimes(const vector<int64_t> & values, string & chunk, string & stats)
+{
+    int64_t minValue = values.empty() ? 0 : values.front(), maxValue = minValue;
+    for(int64_t value : values)
+    {
+        appendLittleEndian(chunk, (uint64_t)value, 8);
+        minValue = min(minValue, value);
+        maxValue = max(maxValue, value);
+    }
+    appendLittleEndian(stats, (uint64_t)minValue, 8);
+    appendLittleEndian(stats, (uint64_t)maxValue, 8);
+}
+
+/** @param block set to the encoded block
+ * @param footerEntry the block's footer entry is appended to it
+ */
+void encodeBlock(const EventColumnRows & rows, uint64_t blockOffset, string & block, string & footerEntry)
+{
+    string chunks[columnCount], stats[columnCount];
+    encodeStrings(rows.deviceNames, chunks[0], stats[0]);
+    encodeTimes(rows.deviceTimes, chunks[1], stats[1]);
+    encodeTimes(rows.receiveTimes, chunks[2], stats[2]);
+    encodeStrings(rows.texts, chunks[3], stats[3]);
+    string body;
+    block.clear();
+    appendLittleEndian(block, rows.size(), 4);
+    for(const string & chunk : chunks)
+    {
+        appendLittleEndian(block, chunk.size(), 4);
+        body += chunk;
+    }
+    appendLittleEndian(block, crc32(body.data(), body.size()), 4);
+    block += body;
+    appendLittleEndian(footerEntry, blockOffset, 8);
+    appendLittleEndian(footerEntry, rows.size(), 4);
+    uint64_t chunkOffset = blockOffset + blockHeaderSize;
+    for(size_t i = 0; i < columnCount; i++)
+    {
+        appendLittleEndian(footerEntry, chunkOffset, 8);
+        appendLittleEndian(footerEntry, chunks[i].size(), 4);
+        footerEntry += stats[i];
+        chunkOffset += chunks[i].size();
+    }
+}
+
+void decodeStrings(const uint8_t * bytes, size_t size, size_t rowCount, vector<string> & dictionary, vector<uint32_t> & codes)
+{
+    const IOException invalidChunk("IO Error : invalid column chunk");
+    dictionary.clear();
+    codes.clear();
+    if(size < 4)
+        throw invalidChunk;
+    size_t dictionarySize = readLittleEndian(bytes, 4);
+    size_t location = 4;
+    for(size_t i = 0; i < dictionarySize; i++)
+    {
+        if(size - location < 4)
+            throw invalidChunk;
+        size_t length = readLittleEndian(bytes + location, 4);
+        location += 4;
+        if(size - location < length)
+            throw invalidChunk;
+        dictionary.push_back(string((const char *)bytes + location, length));
+        location += length;
+    }
+    if(size - location != 4 * rowCount)
+        throw invalidChunk;
+    codes.resize(rowCount);
+    for(size_t i = 0; i < rowCount; i++, location += 4)
+    {
+        codes[i] = readLittleEndian(bytes + location, 4);
+        if(codes[i] >= dictionarySize)
+            throw invalidChunk;
+    }
+}
+
+void decodeTimes(const uint8_t * bytes, size_t size, size_t rowCount, vector<int64_t> & values)
+{
+    if(size != 8 * rowCount)
+        throw IOException("IO Error : invalid column chunk");
+    values.resize(rowCount);
+    for(size_t i = 0; i < rowCount; i++)
+        values[i] = (int64_t)readLittleEndian(bytes + 8 * i, 8);
+}
+
+void decodeStringRows(const uint8_t * bytes, size_t size, size_t rowCount, vector<string> & values)
+{
+    vector<string> dictionary;
+    vector<uint32_t> codes;
+    decodeStrings(bytes, size, rowCount, dictionary, codes);
+    values.clear();
+    for(uint32_t code : codes)
+        values.push_back(dictionary[code]);
+}
+
+string makeHeader()
+{
+    string retval(headerMagic, sizeof(headerMagic));
+    appendLittleEndian(retval, EventColumnWriter::Version, 4);
+    return retval;
+}
+
+string makeFooter(uint32_t blockCount, const string & footerBlocks, uint64_t footerOffset)
+{
+    string retval;
+    appendLittleEndian(retval, columnCount, 4);
+    for(size_t i = 0; i < columnCount; i++)
+    {
+        appendLittleEndian(retval, (uint8_t)columnTypes[i], 1);
+        string name = columnNames[i];
+        appendLittleEndian(retval, name.size(), 2);
+        retval += name;
+    }
+    appendLittleEndian(retval, blockCount, 4);
+    retval += footerBlocks;
+    appendLittleEndian(retval, crc32(retval.data(), retval.size()), 4);
+    appendLittleEndian(retval, footerOffset, 8);
+    retval.append(footerMagic, sizeof(footerMagic));
+    return retval;
+}
+
+void writeAll(int fd, const string & buffer, const string & fileName)
+{
+    const char * pbuffer = buffer.data();
+    size_t sizeLeft = buffer.size();
+    while(sizeLeft > 0)
+    {
+        ssize_t retval = ::write(fd, pbuffer, sizeLeft);
+        if(retval == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            throw IOException("IO Error : can't write to " + fileName + " : " + strerror(errno));
+        }
+        sizeLeft -= retval;
+        pbuffer += retval;
+    }
+}
+
+bool fileExists(const string & fileName)
+{
+    struct stat st;
+    return stat(fileName.c_str(), &st) == 0;
+}
+
+/** @return a name for a new file in directory that isn't used by a finished or pending file */
+string getNewFileName(const string & directory)
+{
+    string prefix = directory + "/events-" + to_string((long long)time(NULL));
+    string retval = prefix + ".pcc";
+    for(unsigned i = 1; fileExists(retval) || fileExists(retval + pendingSuffix); i++)
+        retval = prefix + "-" + to_string(i) + ".pcc";
+    return retval;
+}
+}
+
+void EventColumnRows::clear()
+{
+    deviceNames.clear();
+    deviceTimes.clear();
+    receiveTimes.clear();
+    texts.clear();
+}
+
+void EventColumnRows::add(const string & deviceName, const Event & event)
+{
+    deviceNames.push_back(deviceName);
+    deviceTimes.push_back(event.deviceTime);
+    receiveTimes.push_back(event.receiveTime);
+    texts.push_back(event.text);
+}
+
+EventColumnWriter::EventColumnWriter(string directory, size_t blockRowCount, size_t blocksPerFile, time_t blockDuration)
+    : directory(directory), blockRowCount(max<size_t>(blockRowCount, 1)), blocksPerFile(max<size_t>(blocksPerFile, 1)), blockDuration(max<time_t>(blockDuration, 1))
+{
+    mkdir(directory.c_str(), 0755);
+    // finish the files left pending by a previous run
+    DIR * dir = opendir(directory.c_str());
+    if(dir == nullptr)
+        throw IOException("IO Error : can't open " + directory + " : " + strerror(errno));
+    vector<string> pendingFileNames;
+    while(dirent * entry = readdir(dir))
+    {
+        string name = entry->d_name;
+        if(name.size() > pendingSuffix.size() && name.compare(name.size() - pendingSuffix.size(), string::npos, pendingSuffix) == 0)
+            pendingFileNames.push_back(directory + "/" + name);
+    }
+    closedir(dir);
+    for(const string & pendingFileName : pendingFileNames)
+        finishPendingFile(pendingFileName, pendingFileName.substr(0, pendingFileName.size() - pendingSuffix.size()));
+    flushThread = thread(&EventColumnWriter::flushFn, this);
+}
+
+EventColumnWriter::~EventColumnWriter()
+{
+    flushLock.lock();
+    done = true;
+    flushCond.notify_all();
+    flushLock.unlock();
+    flushThread.join();
+    try
+    {
+        writeBlock();
+        finishFile();
+    }
+    catch(exception & e)
+    {
+        cerr << "Error : " << e.what() << endl;
+    }
+}
+
+void EventColumnWriter::writeBlock()
+{
+    if(pendingRows.size() == 0)
+        return;
+    if(fd == -1)
+    {
+        fileName = getNewFileName(directory);
+        fd = open((fileName + pendingSuffix).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd == -1)
+            throw IOException("IO Error : can't create " + fileName + pendingSuffix + " : " + strerror(errno));
+        string header = makeHeader();
+        writeAll(fd, header, fileName + pendingSuffix);
+        fileSize = header.size();
+        blockCount = 0;
+        footerBlocks.clear();
+    }
+    string block;
+    encodeBlock(pendingRows, fileSize, block, footerBlocks);
+    pendingRows.clear();
+    writeAll(fd, block, fileName + pendingSuffix);
+    fileSize += block.size();
+    if(++blockCount >= blocksPerFile)
+        finishFile();
+}
+
+void EventColumnWriter::finishFile()
+{
+    if(fd == -1)
+        return;
+    string footer = makeFooter(blockCount, footerBlocks, fileSize);
+    footerBlocks.clear();
+    try
+    {
+        writeAll(fd, footer, fileName + pendingSuffix);
+    }
+    catch(exception & e)
+    {
+        close(fd);
+        fd = -1;
+        throw;
+    }
+    close(fd);
+    fd = -1;
+    if(rename((fileName + pendingSuffix).c_str(), fileName.c_str()) == -1)
+        throw IOException("IO Error : can't rename " + fileName + pendingSuffix + " : " + strerror(errno));
+}
+
+void EventColumnWriter::flushFn()
+{
+    // writes a block that has been pending for blockDuration even if no more events arrive
+    unique_lock<mutex> lockIt(flushLock);
+    while(!done)
+    {
+        flushCond.wait_for(lockIt, chrono::seconds(blockDuration));
+        if(done)
+            break;
+        lockIt.unlock();
+        try
+        {
+            lock_guard<mutex> lockWriter(lock);
+            if(pendingRows.size() > 0 && time(NULL) - pendingStartTime >= blockDuration)
+                writeBlock();
+        }
+        catch(exception & e)
+        {
+            cerr << "Error : " << e.what() << endl;
+        }
+        lockIt.lock();
+    }
+}
+
+void EventColumnWriter::writeEvents(const string & deviceName, const vector<Event> & events)
+{
+    lock_guard<mutex> lockIt(lock);
+    time_t now = time(NULL);
+    if(pendingRows.size() > 0 && now - pendingStartTime >= blockDuration)
+        writeBlock();
+    for(const Event & event : events)
+    {
+        if(pendingRows.size() == 0)
+            pendingStartTime = now;
+        pendingRows.add(deviceName, event);
+        if(pendingRows.size() >= blockRowCount)
+            writeBlock();
+    }
+}
+
+string EventColumnWriter::writeFile(string directory, const vector<EventColumnRows> & blocks)
+{
+    mkdir(directory.c_str(), 0755);
+    string buffer = makeHeader(), footerBlocks, block;
+    for(const EventColumnRows & rows : blocks)
+    {
+        encodeBlock(rows, buffer.size(), block, footerBlocks);
+        buffer += block;
+    }
+    buffer += makeFooter(blocks.size(), footerBlocks, buffer.size());
+    string fileName = getNewFileName(directory);
+    string tempFileName = fileName + pendingSuffix;
+    int fd = open(tempFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd == -1)
+        throw IOException("IO Error : can't create " + tempFileName + " : " + strerror(errno));
+    try
+    {
+        writeAll(fd, buffer, tempFileName);
+    }
+    catch(exception & e)
+    {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    if(rename(tempFileName.c_str(), fileName.c_str()) == -1)
+        throw IOException("IO Error : can't rename " + tempFileName + " : " + strerror(errno));
+    return fileName;
+}
+
+void EventColumnWriter::finishPendingFile(string pendingFileName, string fileName)
+{
+    ifstream is(pendingFileName.c_str(), ios::binary);
+    if(!is)
+        throw IOException("IO Error : can't open " + pendingFileName);
+    string contents((istreambuf_iterator<char>(is)), istreambuf_iterator<char>());
+    is.close();
+    const uint8_t * bytes = (const uint8_t *)contents.data();
+    if(contents.size() < headerSize || memcmp(bytes, headerMagic, sizeof(headerMagic)) != 0)
+    {
+        // nothing was written that could be kept
+        unlink(pendingFileName.c_str());
+        return;
+    }
+    size_t location = headerSize;
+    uint32_t blockCount = 0;
+    string footerBlocks, block;
+    EventColumnRows rows;
+    while(contents.size() - location >= blockHeaderSize)
+    {
+        const uint8_t * blockHeader = bytes + location;
+        size_t rowCount = readLittleEndian(blockHeader, 4);
+        size_t chunkSizes[columnCount];
+        size_t bodySize = 0;
+        for(size_t i = 0; i < columnCount; i++)
+        {
+            chunkSizes[i] = readLittleEndian(blockHeader + 4 + 4 * i, 4);
+            bodySize += chunkSizes[i];
+        }
+        const uint8_t * body = blockHeader + blockHeaderSize;
+        if(contents.size() - location - blockHeaderSize < bodySize || crc32(body, bodySize) != readLittleEndian(blockHeader + 4 + 4 * columnCount, 4))
+            break;
+        try
+        {
+            const uint8_t * chunk = body;
+            decodeStringRows(chunk, chunkSizes[0], rowCount, rows.deviceNames);
+            chunk += chunkSizes[0];
+            decodeTimes(chunk, chunkSizes[1], rowCount, rows.deviceTimes);
+            chunk += chunkSizes[1];
+            decodeTimes(chunk, chunkSizes[2], rowCount, rows.receiveTimes);
+            chunk += chunkSizes[2];
+            decodeStringRows(chunk, chunkSizes[3], rowCount, rows.texts);
+        }
+        catch(IOException & e)
+        {
+            break;
+        }
+        encodeBlock(rows, location, block, footerBlocks);
+        blockCount++;
+        location += blockHeaderSize + bodySize;
+    }
+    contents.resize(location);
+    contents += makeFooter(blockCount, footerBlocks, location);
+    string tempFileName = fileName + ".tmp";
+    int fd = open(tempFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd == -1)
+        throw IOException("IO Error : can't create " + tempFileName + " : " + strerror(errno));
+    try
+    {
+        writeAll(fd, contents, tempFileName);
+    }
+    catch(exception & e)
+    {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    if(rename(tempFileName.c_str(), fileName.c_str()) == -1)
+        throw IOException("IO Error : can't rename " + tempFileName + " : " + strerror(errno));
+    unlink(pendingFileName.c_str());
+}
+
+EventColumnFile::EventColumnFile(string fileName)
+{
+    int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1)
+        throw IOException("IO Error : can't open " + fileName + " : " + strerror(errno));
+    struct stat st;
+    if(fstat(fd, &st) == -1 || (size_t)st.st_size < headerSize + trailerSize)
+    {
+        close(fd);
+        throw IOException("IO Error : invalid columnar file " + fileName);
+    }
+    size = st.st_size;
+    void * pmem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pmem == MAP_FAILED)
+        throw IOException("IO Error : can't map " + fileName + " : " + strerror(errno));
+    mem = (const uint8_t *)pmem;
+    const IOException invalidFile("IO Error : invalid columnar file " + fileName);
+    try
+    {
+        const uint8_t * trailer = mem + size - trailerSize;
+        size_t footerOffset = readLittleEndian(trailer + 4, 8);
+        if(memcmp(mem, headerMagic, sizeof(headerMagic)) != 0 || memcmp(trailer + 12, footerMagic, sizeof(footerMagic)) != 0
+           || footerOffset < headerSize || footerOffset > size - trailerSize
+           || crc32(mem + footerOffset, size - trailerSize - footerOffset) != readLittleEndian(trailer, 4))
+            throw invalidFile;
+        if(readLittleEndian(mem + sizeof(headerMagic), 4) != EventColumnWriter::Version)
+            throw IOException("IO Error : unsupported columnar file version in " + fileName);
+        const uint8_t * footer = mem + footerOffset;
+        size_t footerSize = size - trailerSize - footerOffset, location = 0;
+        auto need = [&](size_t byteCount)
+        {
+            if(footerSize - location < byteCount)
+                throw invalidFile;
+        };
+        auto readString = [&](size_t lengthSize)
+        {
+            need(lengthSize);
+            size_t length = readLittleEndian(footer + location, lengthSize);
+            location += lengthSize;
+            need(length);
+            string retval((const char *)footer + location, length);
+            location += length;
+            return retval;
+        };
+        need(4);
+        size_t fileColumnCount = readLittleEndian(footer, 4);
+        location = 4;
+        for(size_t i = 0; i < fileColumnCount; i++)
+        {
+            need(1);
+            uint8_t type = footer[location++];
+            if(type > (uint8_t)EventColumnType::Time)
+                throw invalidFile;
+            string name = readString(2);
+            columns.push_back(make_pair(name, (EventColumnType)type));
+        }
+        need(4);
+        size_t fileBlockCount = readLittleEndian(footer + location, 4);
+        location += 4;
+        for(size_t i = 0; i < fileBlockCount; i++)
+        {
+            Block block;
+            need(12);
+            location += 8; // block offset, for recovery tools
+            block.rowCount = readLittleEndian(footer + location, 4);
+            location += 4;
+            for(size_t column = 0; column < columns.size(); column++)
+            {
+                Chunk chunk;
+                need(12);
+                chunk.offset = readLittleEndian(footer + location, 8);
+                chunk.size = readLittleEndian(footer + location + 8, 4);
+                location += 12;
+                if(chunk.offset > footerOffset || footerOffset - chunk.offset < chunk.size)
+                    throw invalidFile;
+                if(columns[column].second == EventColumnType::Time)
+                {
+                    need(16);
+                    chunk.minTime = (int64_t)readLittleEndian(footer + location, 8);
+                    chunk.maxTime = (int64_t)readLittleEndian(footer + location + 8, 8);
+                    location += 16;
+                }
+                else
+                {
+                    chunk.minString = readString(4);
+                    chunk.maxString = readString(4);
+                }
+                block.chunks.push_back(move(chunk));
+            }
+            blocks.push_back(move(block));
+        }
+    }
+    catch(exception & e)
+    {
+        munmap((void *)mem, size);
+        throw;
+    }
+}
+
+EventColumnFile::~EventColumnFile()
+{
+    munmap((void *)mem, size);
+}
+
+size_t EventColumnFile::findColumn(const string & name) const
+{
+    for(size_t i = 0; i < columns.size(); i++)
+        if(columns[i].first == name)
+            return i;
+    return columns.size();
+}
+
+const EventColumnFile::Chunk & EventColumnFile::getChunk(size_t block, size_t column, EventColumnType type) const
+{
+    if(block >= blocks.size() || column >= columns.size() || columns[column].second != type)
+        throw runtime_error("no such column chunk");
+    return blocks[block].chunks[column];
+}
+
+int64_t EventColumnFile::getMinTime(size_t block, size_t column) const
+{
+    return getChunk(block, column, EventColumnType::Time).minTime;
+}
+
+int64_t EventColumnFile::getMaxTime(size_t block, size_t column) const
+{
+    return getChunk(block, column, EventColumnType::Time).maxTime;
+}
+
+const string & EventColumnFile::getMinString(size_t block, size_t column) const
+{
+    return getChunk(block, column, EventColumnType::String).minString;
+}
+
+const string & EventColumnFile::getMaxString(size_t block, size_t column) const
+{
+    return getChunk(block, column, EventColumnType::String).maxString;
+}
+
+void EventColumnFile::readTimes(size_t block, size_t column, vector<int64_t> & values) const
+{
+    const Chunk & chunk = getChunk(block, column, EventColumnType::Time);
+    decodeTimes(mem + chunk.offset, chunk.size, blocks[block].rowCount, values);
+}
+
+void EventColumnFile::readStrings(size_t block, size_t column, vector<string> & dictionary, vector<uint32_t> & codes) const
+{
+    const Chunk & chunk = getChunk(block, column, EventColumnType::String);
+    decodeStrings(mem + chunk.offset, chunk.size, blocks[block].rowCount, dictionary, codes);
+}
@@ -0,0 +1,164 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef EVENTCOLUMNS_H_INCLUDED
+#define EVENTCOLUMNS_H_INCLUDED
+
+#include "eventsink.h"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+
+using namespace std;
+
+enum class EventColumnType : uint8_t
+{
+    String = 0, // dictionary encoded, stats are the least and greatest value
+    Time = 1, // seconds since the epoch, stats are the least and greatest value
+};
+
+/** the rows of one block, column by column */
+struct EventColumnRows
+{
+    vector<string> deviceNames;
+    vector<int64_t> deviceTimes;
+    vector<int64_t> receiveTimes; // 0 if unknown
+    vector<string> texts;
+    size_t size() const
+    {
+        return deviceNames.size();
+    }
+    void clear();
+    void add(const string & deviceName, const Event & event);
+};
+
+/** writes events into self describing columnar files for analytics. Events are collected into blocks that are
+ * written as one chunk per column, so scans only read the columns they need and skip blocks by the stats in the footer.
+ * A block is written when it has blockRowCount events or when events arrive blockDuration seconds after its first one,
+ * a file is finished after blocksPerFile blocks or when the writer is destroyed. Files are written with a .pending suffix
+ * until they're finished, pending files left by a previous run get their footer when the next writer starts.
+ *
+ * file layout (little endian) :
+ *   "PCCOLEV" + NUL, u32 version
+ *   blocks : u32 row count, u32 chunk size per column, u32 CRC-32 of the chunks, then the chunks in column order
+ *     String chunk : u32 dictionary size, dictionary entries (u32 length + bytes) in order of first use, u32 entry index per row
+ *     Time chunk : i64 per row
+ *   footer : u32 column count, columns (u8 type, u16 length + name), u32 block count,
+ *            blocks (u64 block offset, u32 row count, per column : u64 chunk offset, u32 chunk size, min, max)
+ *            where min and max are i64 for Time columns and u32 length + bytes for String columns,
+ *            u32 CRC-32 of the footer so far, u64 footer offset, "PCCOLFT" + NUL
+ *   columns : device (String), device-time (Time), receive-time (Time), text (String)
+ */
+class EventColumnWriter final : public EventSink
+{
+private:
+    mutex lock;
+    const string directory;
+    const size_t blockRowCount;
+    const size_t blocksPerFile;
+    const time_t blockDuration;
+    EventColumnRows pendingRows;
+    time_t pendingStartTime = 0;
+    int fd = -1;
+    string fileName; // without the pending suffix
+    uint64_t fileSize = 0;
+    uint32_t blockCount = 0;
+    string footerBlocks;
+    void writeBlock();
+    mutex flushLock;
+    condition_variable flushCond;
+    bool done = false;
+    thread flushThread;
+    void flushFn();
+    void finishFile();
+public:
+    static const uint32_t Version = 1;
+    EventColumnWriter(string directory, size_t blockRowCount, size_t blocksPerFile, time_t blockDuration);
+    /** writes the pending events and finishes the file */
+    ~EventColumnWriter();
+    virtual void writeEvents(const string & deviceName, const vector<Event> & events) override;
+    /** writes rows to a new file in directory, for converting events from elsewhere
+     * @return the file name
+     */
+    static string writeFile(string directory, const vector<EventColumnRows> & blocks);
+    /** adds the footer to a file whose writer didn't finish it, keeping the intact blocks */
+    static void finishPendingFile(string pendingFileName, string fileName);
+};
+
+/** read access to a finished columnar file through mmap. Chunks are checked against their bounds but not their CRC,
+ * which covers the whole block.
+ */
+class EventColumnFile final
+{
+    EventColumnFile(const EventColumnFile &) = delete;
+    const EventColumnFile & operator =(const EventColumnFile &) = delete;
+private:
+    struct Chunk
+    {
+        uint64_t offset;
+        uint32_t size;
+        int64_t minTime = 0, maxTime = 0;
+        string minString, maxString;
+    };
+    struct Block
+    {
+        uint32_t rowCount;
+        vector<Chunk> chunks;
+    };
+    const uint8_t * mem = nullptr;
+    size_t size = 0;
+    vector<pair<string, EventColumnType>> columns;
+    vector<Block> blocks;
+    const Chunk & getChunk(size_t block, size_t column, EventColumnType type) const;
+public:
+    explicit EventColumnFile(string fileName);
+    ~EventColumnFile();
+    size_t getColumnCount() const
+    {
+        return columns.size();
+    }
+    const string & getColumnName(size_t column) const
+    {
+        return columns[column].first;
+    }
+    EventColumnType getColumnType(size_t column) const
+    {
+        return columns[column].second;
+    }
+    /** @return the index of the column called name, getColumnCount() if there isn't one */
+    size_t findColumn(const string & name) const;
+    size_t getBlockCount() const
+    {
+        return blocks.size();
+    }
+    uint32_t getRowCount(size_t block) const
+    {
+        return blocks[block].rowCount;
+    }
+    /** @return the stats of a Time column */
+    int64_t getMinTime(size_t block, size_t column) const;
+    int64_t getMaxTime(size_t block, size_t column) const;
+    /** @return the stats of a String column */
+    const string & getMinString(size_t block, size_t column) const;
+    const string & getMaxString(size_t block, size_t column) const;
+    void readTimes(size_t block, size_t column, vector<int64_t> & values) const;
+    /** @param codes set to the index in dictionary of every row's value */
+    void readStrings(size_t block, size_t column, vector<string> & dictionary, vector<uint32_t> & codes) const;
+};
+
+#endif // EVENTCOLUMNS_H_INCLUDED
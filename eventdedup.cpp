@@ -0,0 +1,90 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "eventdedup.h"
+#include <functional>
+
+using namespace std;
+
+namespace
+{
+uint64_t mixHash(uint64_t h, uint64_t v)
+{
+    h ^= v + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+    return h;
+}
+}
+
+EventDeduplicator::EventDeduplicator(time_t window, size_t maxRecentCount)
+    : window(window < 0 ? 0 : window), maxRecentCount(maxRecentCount < 1 ? 1 : maxRecentCount)
+{
+}
+
+void EventDeduplicator::prune(DeviceState & device)
+{
+    while(!device.recentOrder.empty() && (device.recentOrder.front().first < device.highWaterMark - window || device.recentOrder.size() > maxRecentCount))
+    {
+        device.recentHashes.erase(device.recentOrder.front().second);
+        device.recentOrder.pop_front();
+    }
+}
+
+size_t EventDeduplicator::filter(uint32_t deviceId, vector<Event> & events)
+{
+    RequestState request;
+    return filter(deviceId, events, request);
+}
+
+size_t EventDeduplicator::filter(uint32_t deviceId, vector<Event> & events, RequestState & request)
+{
+    lock_guard<mutex> lockIt(lock);
+    if(deviceId >= devices.size())
+        devices.resize(deviceId + 1);
+    DeviceState & device = devices[deviceId];
+    if(!request.isStarted)
+    {
+        request.isStarted = true;
+        request.oldHighWaterMark = device.highWaterMark;
+        request.hadEvents = device.hasEvents;
+    }
+    unordered_map<uint64_t, uint64_t> & occurrences = request.occurrences;
+    time_t oldHighWaterMark = request.oldHighWaterMark;
+    bool hadEvents = request.hadEvents;
+    size_t keptCount = 0;
+    for(Event & event : events)
+    {
+        uint64_t key = mixHash(hash<string>()(event.text), (uint64_t)event.deviceTime);
+        key = mixHash(key, occurrences[key]++);
+        // compare against the state from before this request so events in it can't shadow each other
+        if(hadEvents && event.deviceTime < oldHighWaterMark - window)
+            continue;
+        if(device.recentHashes.count(key) != 0)
+            continue;
+        device.recentHashes.insert(key);
+        device.recentOrder.push_back(make_pair(event.deviceTime, key));
+        if(!device.hasEvents || event.deviceTime > device.highWaterMark)
+            device.highWaterMark = event.deviceTime;
+        device.hasEvents = true;
+        if(&events[keptCount] != &event)
+            events[keptCount] = move(event);
+        keptCount++;
+    }
+    size_t removedCount = events.size() - keptCount;
+    events.erase(events.begin() + keptCount, events.end());
+    prune(device);
+    return removedCount;
+}
@@ -0,0 +1,75 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef EVENTDEDUP_H_INCLUDED
+#define EVENTDEDUP_H_INCLUDED
+
+#include "eventsink.h"
+#include <mutex>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include <unordered_set>
+#include <cstdint>
+
+using namespace std;
+
+/** drops events that a device sends again because it didn't get the acknowledgement for an earlier request.
+ * For every device the highest accepted device time is kept along with hashes of the events accepted within
+ * the window before it. Events older than the window are retransmissions, events inside the window are
+ * retransmissions if their hash was seen. Identical events in one request are told apart by their occurrence number.
+ */
+class EventDeduplicator final
+{
+private:
+    struct DeviceState
+    {
+        time_t highWaterMark = 0;
+        bool hasEvents = false;
+        unordered_set<uint64_t> recentHashes;
+        deque<pair<time_t, uint64_t>> recentOrder; // in insertion order, for pruning
+    };
+    mutex lock;
+    vector<DeviceState> devices; // indexed by device id
+    const time_t window;
+    const size_t maxRecentCount;
+    void prune(DeviceState & device);
+public:
+    /** what filter keeps about a request whose events are filtered in several batches */
+    struct RequestState
+    {
+        bool isStarted = false;
+        time_t oldHighWaterMark = 0;
+        bool hadEvents = false;
+        unordered_map<uint64_t, uint64_t> occurrences;
+    };
+    /** @param window how far behind the highest accepted device time events are still checked against the hash set
+     * @param maxRecentCount the maximum number of hashes kept per device
+     */
+    EventDeduplicator(time_t window, size_t maxRecentCount);
+    /** removes already accepted events from events and records the rest as accepted
+     * @param deviceId the id from the device registry
+     * @return the number of events removed
+     */
+    size_t filter(uint32_t deviceId, vector<Event> & events);
+    /** filters one batch of the events of a request, comparing them against the state from before its first batch
+     * @param request the same for all the batches of a request
+     */
+    size_t filter(uint32_t deviceId, vector<Event> & events, RequestState & request);
+};
+
+#endif // EVENTDEDUP_H_INCLUDED
@@ -0,0 +1,135 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "eventindex.h"
+#include <algorithm>
+
+using namespace std;
+
+EventIndex::EventIndex(time_t bucketSeconds, time_t retentionTime, size_t recentEventCount)
+    : bucketSeconds(max<time_t>(bucketSeconds, 1)), retentionTime(retentionTime), recentEventCount(recentEventCount)
+{
+}
+
+int64_t EventIndex::getBucketIndex(time_t t) const
+{
+    int64_t retval = t / bucketSeconds;
+    if(t % bucketSeconds < 0)
+        retval--;
+    return retval;
+}
+
+int64_t EventIndex::getFirstKeptBucket() const
+{
+    return getBucketIndex(time(NULL) - retentionTime);
+}
+
+void EventIndex::dropOldBuckets()
+{
+    int64_t firstKeptBucket = getFirstKeptBucket();
+    while(!expiryQueue.empty() && get<0>(*expiryQueue.begin()) < firstKeptBucket)
+    {
+        for(const string & deviceName : get<1>(*expiryQueue.begin()))
+        {
+            auto deviceIter = devices.find(deviceName);
+            if(deviceIter != devices.end())
+                get<1>(*deviceIter).buckets.erase(get<0>(*expiryQueue.begin()));
+        }
+        expiryQueue.erase(expiryQueue.begin());
+    }
+}
+
+void EventIndex::writeEvents(const string & deviceName, const vector<Event> & events)
+{
+    lock_guard<mutex> lockIt(lock);
+    dropOldBuckets();
+    DeviceIndex & device = devices[deviceName];
+    int64_t firstKeptBucket = getFirstKeptBucket();
+    for(const Event & event : events)
+    {
+        device.lastReceiveTime = max(device.lastReceiveTime, event.receiveTime);
+        device.lastDeviceTime = max(device.lastDeviceTime, event.deviceTime);
+        if(recentEventCount > 0)
+        {
+            if(device.recentEvents.size() >= recentEventCount)
+                device.recentEvents.pop_front();
+            device.recentEvents.push_back(event);
+        }
+        int64_t bucketIndex = getBucketIndex(event.deviceTime);
+        if(bucketIndex < firstKeptBucket)
+            continue;
+        auto inserted = device.buckets.insert(make_pair(bucketIndex, Bucket()));
+        if(get<1>(inserted))
+            expiryQueue[bucketIndex].push_back(deviceName);
+        vector<time_t> & deviceTimes = get<1>(*get<0>(inserted)).deviceTimes;
+        deviceTimes.insert(upper_bound(deviceTimes.begin(), deviceTimes.end(), event.deviceTime), event.deviceTime);
+    }
+}
+
+uint64_t EventIndex::count(const string & deviceName, time_t startTime, time_t endTime) const
+{
+    lock_guard<mutex> lockIt(lock);
+    auto deviceIter = devices.find(deviceName);
+    if(deviceIter == devices.end() || startTime > endTime)
+        return 0;
+    const map<int64_t, Bucket> & buckets = get<1>(*deviceIter).buckets;
+    int64_t startBucket = getBucketIndex(startTime), endBucket = getBucketIndex(endTime);
+    uint64_t retval = 0;
+    for(auto iter = buckets.lower_bound(max(startBucket, getFirstKeptBucket())); iter != buckets.end() && get<0>(*iter) <= endBucket; ++iter)
+    {
+        const vector<time_t> & deviceTimes = get<1>(*iter).deviceTimes;
+        if(get<0>(*iter) != startBucket && get<0>(*iter) != endBucket)
+        {
+            retval += deviceTimes.size(); // the whole bucket is in the range
+            continue;
+        }
+        retval += upper_bound(deviceTimes.begin(), deviceTimes.end(), endTime) - lower_bound(deviceTimes.begin(), deviceTimes.end(), startTime);
+    }
+    return retval;
+}
+
+void EventIndex::lastSeen(const string & deviceName, function<void(const string & deviceName, time_t lastReceiveTime, time_t lastDeviceTime)> fn) const
+{
+    vector<pair<string, pair<time_t, time_t>>> results;
+    {
+        lock_guard<mutex> lockIt(lock);
+        for(const pair<const string, DeviceIndex> & device : devices)
+        {
+            if(deviceName.empty() || deviceName == get<0>(device))
+                results.push_back(make_pair(get<0>(device), make_pair(get<1>(device).lastReceiveTime, get<1>(device).lastDeviceTime)));
+        }
+    }
+    sort(results.begin(), results.end());
+    for(const auto & result : results)
+        fn(get<0>(result), get<0>(get<1>(result)), get<1>(get<1>(result)));
+}
+
+void EventIndex::recent(const string & deviceName, size_t maxCount, function<void(const Event & event)> fn) const
+{
+    vector<Event> results;
+    {
+        lock_guard<mutex> lockIt(lock);
+        auto deviceIter = devices.find(deviceName);
+        if(deviceIter == devices.end())
+            return;
+        const deque<Event> & recentEvents = get<1>(*deviceIter).recentEvents;
+        size_t count = min(maxCount, recentEvents.size());
+        results.assign(recentEvents.end() - count, recentEvents.end());
+    }
+    for(const Event & event : results)
+        fn(event);
+}
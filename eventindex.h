@@ -0,0 +1,68 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef EVENTINDEX_H_INCLUDED
+#define EVENTINDEX_H_INCLUDED
+
+#include "eventsink.h"
+#include <mutex>
+#include <map>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+using namespace std;
+
+/** in-memory per device index of the events in fixed size device time buckets, for answering queries.
+ * Buckets older than the retention time are dropped on every write, whichever device it's for, and ignored by queries.
+ */
+class EventIndex final : public EventSink
+{
+private:
+    struct Bucket
+    {
+        vector<time_t> deviceTimes;
+    };
+    struct DeviceIndex
+    {
+        map<int64_t, Bucket> buckets;
+        time_t lastReceiveTime = 0;
+        time_t lastDeviceTime = 0;
+        deque<Event> recentEvents;
+    };
+    mutable mutex lock;
+    unordered_map<string, DeviceIndex> devices;
+    map<int64_t, vector<string>> expiryQueue; // the devices that have each bucket, so old buckets are dropped for every device
+    const time_t bucketSeconds;
+    const time_t retentionTime;
+    const size_t recentEventCount;
+    int64_t getBucketIndex(time_t t) const;
+    int64_t getFirstKeptBucket() const;
+    void dropOldBuckets();
+public:
+    EventIndex(time_t bucketSeconds, time_t retentionTime, size_t recentEventCount);
+    virtual void writeEvents(const string & deviceName, const vector<Event> & events) override;
+    /** @return the number of events of deviceName with startTime <= device time <= endTime */
+    uint64_t count(const string & deviceName, time_t startTime, time_t endTime) const;
+    /** calls fn with the device name, last receive time and last device time of every device, or just deviceName if it isn't empty */
+    void lastSeen(const string & deviceName, function<void(const string & deviceName, time_t lastReceiveTime, time_t lastDeviceTime)> fn) const;
+    /** calls fn with the last maxCount events received from deviceName, oldest first */
+    void recent(const string & deviceName, size_t maxCount, function<void(const Event & event)> fn) const;
+};
+
+#endif // EVENTINDEX_H_INCLUDED
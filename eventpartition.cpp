@@ -0,0 +1,444 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "eventpartition.h"
+#include "stream.h"
+#include "checksum.h"
+#include "binaryio.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+namespace
+{
+const char footerMagic[8] = {'P', 'C', 'E', 'V', 'I', 'D', 'X', '\0'};
+const size_t trailerSize = 4 + 8 + sizeof(footerMagic);
+const uint32_t bloomHashCount = 7;
+const size_t bloomBitsPerDevice = 10;
+
+struct Record
+{
+    string deviceName;
+    Event event;
+    Record(string deviceName, Event event)
+        : deviceName(move(deviceName)), event(move(event))
+    {
+    }
+};
+
+void appendRecord(string & buffer, const string & deviceName, const Event & event)
+{
+    appendLittleEndian(buffer, (uint64_t)(int64_t)event.deviceTime, 8);
+    appendLittleEndian(buffer, (uint64_t)(int64_t)event.receiveTime, 8);
+    appendLittleEndian(buffer, min<size_t>(deviceName.size(), 0xFFFF), 2);
+    buffer.append(deviceName, 0, 0xFFFF);
+    appendLittleEndian(buffer, event.text.size(), 4);
+    buffer += event.text;
+}
+
+/** @return the size of the record at bytes, 0 if it's incomplete */
+size_t getRecordSize(const uint8_t * bytes, size_t size)
+{
+    if(size < 18)
+        return 0;
+    size_t deviceNameSize = readLittleEndian(bytes + 16, 2);
+    if(size < 22 + deviceNameSize)
+        return 0;
+    size_t textSize = readLittleEndian(bytes + 18 + deviceNameSize, 4);
+    if(size - 22 - deviceNameSize < textSize)
+        return 0;
+    return 22 + deviceNameSize + textSize;
+}
+
+time_t getRecordDeviceTime(const uint8_t * bytes)
+{
+    return (time_t)(int64_t)readLittleEndian(bytes, 8);
+}
+
+bool recordHasDevice(const uint8_t * bytes, const string & deviceName)
+{
+    size_t deviceNameSize = readLittleEndian(bytes + 16, 2);
+    return deviceNameSize == deviceName.size() && memcmp(bytes + 18, deviceName.data(), deviceNameSize) == 0;
+}
+
+Event readRecordEvent(const uint8_t * bytes)
+{
+    size_t deviceNameSize = readLittleEndian(bytes + 16, 2);
+    size_t textSize = readLittleEndian(bytes + 18 + deviceNameSize, 4);
+    return Event(getRecordDeviceTime(bytes), string((const char *)bytes + 22 + deviceNameSize, textSize), (time_t)(int64_t)readLittleEndian(bytes + 8, 8));
+}
+
+uint64_t hashDeviceName(const string & deviceName)
+{
+    uint64_t retval = 0xCBF29CE484222325ULL; // FNV-1a
+    for(char ch : deviceName)
+    {
+        retval ^= (uint8_t)ch;
+        retval *= 0x100000001B3ULL;
+    }
+    return retval;
+}
+
+size_t getBloomBitIndex(uint64_t hash, uint32_t hashIndex, uint32_t bitCount)
+{
+    uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;
+    return (h1 + (uint64_t)hashIndex * h2) % bitCount;
+}
+
+void writeFile(int fd, const string & buffer, string fileName)
+{
+    const char * pbuffer = buffer.data();
+    size_t sizeLeft = buffer.size();
+    while(sizeLeft > 0)
+    {
+        ssize_t retval = ::write(fd, pbuffer, sizeLeft);
+        if(retval == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            throw IOException("IO Error : can't write to " + fileName + " : " + strerror(errno));
+        }
+        sizeLeft -= retval;
+        pbuffer += retval;
+    }
+}
+
+void appendRecords(vector<Record> & records, const string & contents, size_t size)
+{
+    const uint8_t * bytes = (const uint8_t *)contents.data();
+    for(size_t location = 0, recordSize; (recordSize = getRecordSize(bytes + location, size - location)) != 0; location += recordSize)
+    {
+        size_t deviceNameSize = readLittleEndian(bytes + location + 16, 2);
+        records.push_back(Record(string((const char *)bytes + location + 18, deviceNameSize), readRecordEvent(bytes + location)));
+    }
+}
+
+const string pendingSuffix = ".pending";
+}
+
+string EventPartitionWriter::getPartitionFileName(string directory, time_t start)
+{
+    return directory + "/partition-" + to_string((long long)start) + ".pce";
+}
+
+void EventPartitionWriter::finishPartition(string pendingFileName, string fileName, size_t indexInterval)
+{
+    if(indexInterval == 0)
+        indexInterval = 1;
+    ifstream is(pendingFileName.c_str(), ios::binary);
+    if(!is)
+        throw IOException("IO Error : can't open " + pendingFileName);
+    string contents((istreambuf_iterator<char>(is)), istreambuf_iterator<char>());
+    is.close();
+    vector<Record> records;
+    ifstream finished(fileName.c_str(), ios::binary);
+    if(finished)
+    {
+        // never replace a finished partition, merge the late records into it
+        string finishedContents((istreambuf_iterator<char>(finished)), istreambuf_iterator<char>());
+        finished.close();
+        if(finishedContents.size() < trailerSize)
+            throw IOException("IO Error : invalid partition file " + fileName);
+        const uint8_t * trailer = (const uint8_t *)finishedContents.data() + finishedContents.size() - trailerSize;
+        if(memcmp(trailer + 12, footerMagic, sizeof(footerMagic)) != 0
+           || readLittleEndian(trailer + 4, 8) > finishedContents.size() - trailerSize)
+            throw IOException("IO Error : invalid partition file " + fileName);
+        appendRecords(records, finishedContents, readLittleEndian(trailer + 4, 8));
+    }
+    appendRecords(records, contents, contents.size());
+    contents.clear();
+    stable_sort(records.begin(), records.end(), [](const Record & a, const Record & b)
+    {
+        return a.event.deviceTime < b.event.deviceTime;
+    });
+    string buffer, index;
+    set<string> deviceNames;
+    for(size_t i = 0; i < records.size(); i++)
+    {
+        if(i % indexInterval == 0)
+        {
+            appendLittleEndian(index, (uint64_t)(int64_t)records[i].event.deviceTime, 8);
+            appendLittleEndian(index, buffer.size(), 8);
+        }
+        appendRecord(buffer, records[i].deviceName, records[i].event);
+        deviceNames.insert(records[i].deviceName);
+    }
+    uint32_t bloomBitCount = max<size_t>(64, (deviceNames.size() * bloomBitsPerDevice + 7) / 8 * 8);
+    string bloomBits(bloomBitCount / 8, '\0');
+    for(const string & deviceName : deviceNames)
+    {
+        uint64_t hash = hashDeviceName(deviceName);
+        for(uint32_t i = 0; i < bloomHashCount; i++)
+        {
+            size_t bit = getBloomBitIndex(hash, i, bloomBitCount);
+            bloomBits[bit / 8] |= (char)(1 << (bit % 8));
+        }
+    }
+    size_t footerOffset = buffer.size();
+    appendLittleEndian(buffer, records.size(), 4);
+    appendLittleEndian(buffer, records.empty() ? 0 : (uint64_t)(int64_t)records.front().event.deviceTime, 8);
+    appendLittleEndian(buffer, records.empty() ? 0 : (uint64_t)(int64_t)records.back().event.deviceTime, 8);
+    appendLittleEndian(buffer, indexInterval, 4);
+    appendLittleEndian(buffer, index.size() / 16, 4);
+    buffer += index;
+    appendLittleEndian(buffer, bloomBitCount, 4);
+    appendLittleEndian(buffer, bloomHashCount, 4);
+    buffer += bloomBits;
+    appendLittleEndian(buffer, crc32(buffer.data() + footerOffset, buffer.size() - footerOffset), 4);
+    appendLittleEndian(buffer, footerOffset, 8);
+    buffer.append(footerMagic, sizeof(footerMagic));
+    string tempFileName = fileName + ".tmp";
+    int fd = open(tempFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd == -1)
+        throw IOException("IO Error : can't create " + tempFileName + " : " + strerror(errno));
+    try
+    {
+        writeFile(fd, buffer, tempFileName);
+    }
+    catch(exception & e)
+    {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    if(rename(tempFileName.c_str(), fileName.c_str()) == -1)
+        throw IOException("IO Error : can't rename " + tempFileName + " : " + strerror(errno));
+    unlink(pendingFileName.c_str());
+}
+
+EventPartitionWriter::EventPartitionWriter(string directory, time_t partitionDuration, size_t indexInterval)
+    : directory(directory), partitionDuration(max<time_t>(partitionDuration, 1)), indexInterval(max<size_t>(indexInterval, 1))
+{
+    mkdir(directory.c_str(), 0755);
+    // finish the partitions left pending by a previous run
+    DIR * dir = opendir(directory.c_str());
+    if(dir == nullptr)
+        throw IOException("IO Error : can't open " + directory + " : " + strerror(errno));
+    vector<string> pendingFileNames;
+    while(dirent * entry = readdir(dir))
+    {
+        string name = entry->d_name;
+        if(name.size() > pendingSuffix.size() && name.compare(name.size() - pendingSuffix.size(), string::npos, pendingSuffix) == 0)
+            pendingFileNames.push_back(directory + "/" + name);
+    }
+    closedir(dir);
+    for(const string & pendingFileName : pendingFileNames)
+        finishPartition(pendingFileName, pendingFileName.substr(0, pendingFileName.size() - pendingSuffix.size()), this->indexInterval);
+    finishThread = thread(&EventPartitionWriter::finishFn, this);
+}
+
+EventPartitionWriter::~EventPartitionWriter()
+{
+    lock.lock();
+    queueFinishPartition();
+    lock.unlock();
+    finishLock.lock();
+    done = true;
+    finishCond.notify_all();
+    finishLock.unlock();
+    finishThread.join();
+}
+
+void EventPartitionWriter::openPartition(time_t start)
+{
+    string fileName = getPartitionFileName(directory, start) + pendingSuffix;
+    fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd == -1)
+        throw IOException("IO Error : can't open " + fileName + " : " + strerror(errno));
+    currentPartitionStart = start;
+}
+
+void EventPartitionWriter::queueFinishPartition()
+{
+    if(fd == -1)
+        return;
+    close(fd);
+    fd = -1;
+    lock_guard<mutex> lockIt(finishLock);
+    finishQueue.push_back(currentPartitionStart);
+    finishCond.notify_all();
+}
+
+void EventPartitionWriter::finishFn()
+{
+    unique_lock<mutex> lockIt(finishLock);
+    while(!done || !finishQueue.empty())
+    {
+        if(finishQueue.empty())
+        {
+            finishCond.wait(lockIt);
+            continue;
+        }
+        time_t start = finishQueue.front();
+        finishQueue.pop_front();
+        lockIt.unlock();
+        try
+        {
+            string fileName = getPartitionFileName(directory, start);
+            finishPartition(fileName + pendingSuffix, fileName, indexInterval);
+        }
+        catch(exception & e)
+        {
+            cerr << "Error : " << e.what() << endl;
+        }
+        lockIt.lock();
+    }
+}
+
+void EventPartitionWriter::writeEvents(const string & deviceName, const vector<Event> & events)
+{
+    lock_guard<mutex> lockIt(lock);
+    string buffer;
+    for(const Event & event : events)
+    {
+        time_t start = event.receiveTime - event.receiveTime % partitionDuration;
+        if(event.receiveTime % partitionDuration < 0)
+            start -= partitionDuration;
+        if(fd != -1 && start < currentPartitionStart) // late event, keep it in the current partition
+            start = currentPartitionStart;
+        if(fd == -1 || start != currentPartitionStart)
+        {
+            if(fd != -1)
+                writeFile(fd, buffer, getPartitionFileName(directory, currentPartitionStart) + pendingSuffix);
+            buffer.clear();
+            queueFinishPartition();
+            openPartition(start);
+        }
+        appendRecord(buffer, deviceName, event);
+    }
+    if(fd != -1)
+        writeFile(fd, buffer, getPartitionFileName(directory, currentPartitionStart) + pendingSuffix);
+}
+
+EventPartitionFile::EventPartitionFile(string fileName)
+{
+    int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1)
+        throw IOException("IO Error : can't open " + fileName + " : " + strerror(errno));
+    struct stat st;
+    if(fstat(fd, &st) == -1 || (size_t)st.st_size < trailerSize)
+    {
+        close(fd);
+        throw IOException("IO Error : invalid partition file " + fileName);
+    }
+    size = st.st_size;
+    void * pmem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pmem == MAP_FAILED)
+        throw IOException("IO Error : can't map " + fileName + " : " + strerror(errno));
+    mem = (const uint8_t *)pmem;
+    const uint8_t * trailer = mem + size - trailerSize;
+    size_t footerOffset = readLittleEndian(trailer + 4, 8);
+    const size_t fixedFooterSize = 4 + 8 + 8 + 4 + 4;
+    if(memcmp(trailer + 12, footerMagic, sizeof(footerMagic)) != 0 || footerOffset > size - trailerSize || size - trailerSize - footerOffset < fixedFooterSize
+       || crc32(mem + footerOffset, size - trailerSize - footerOffset) != readLittleEndian(trailer, 4))
+    {
+        munmap((void *)mem, size);
+        throw IOException("IO Error : invalid partition file " + fileName);
+    }
+    const uint8_t * footer = mem + footerOffset;
+    recordsSize = footerOffset;
+    recordCount = readLittleEndian(footer, 4);
+    minTime = (time_t)(int64_t)readLittleEndian(footer + 4, 8);
+    maxTime = (time_t)(int64_t)readLittleEndian(footer + 12, 8);
+    indexCount = readLittleEndian(footer + 24, 4);
+    index = footer + fixedFooterSize;
+    const uint8_t * bloom = index + 16 * (size_t)indexCount;
+    bloomBitCount = readLittleEndian(bloom, 4);
+    bloomHashCount = readLittleEndian(bloom + 4, 4);
+    bloomBits = bloom + 8;
+    if(bloomBits + bloomBitCount / 8 > trailer || bloomBitCount == 0)
+    {
+        munmap((void *)mem, size);
+        throw IOException("IO Error : invalid partition file " + fileName);
+    }
+}
+
+EventPartitionFile::~EventPartitionFile()
+{
+    munmap((void *)mem, size);
+}
+
+bool EventPartitionFile::mayContainDevice(const string & deviceName) const
+{
+    uint64_t hash = hashDeviceName(deviceName);
+    for(uint32_t i = 0; i < bloomHashCount; i++)
+    {
+        size_t bit = getBloomBitIndex(hash, i, bloomBitCount);
+        if((bloomBits[bit / 8] & (1 << (bit % 8))) == 0)
+            return false;
+    }
+    return true;
+}
+
+void EventPartitionFile::query(const string & deviceName, time_t startTime, time_t endTime, function<void(const Event & event)> fn) const
+{
+    if(recordCount == 0 || startTime > maxTime || endTime < minTime || !mayContainDevice(deviceName))
+        return;
+    // find the last index entry before startTime
+    size_t low = 0, high = indexCount;
+    while(low < high)
+    {
+        size_t middle = (low + high) / 2;
+        if((time_t)(int64_t)readLittleEndian(index + 16 * middle, 8) < startTime)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    size_t location = 0;
+    if(low > 0)
+        location = readLittleEndian(index + 16 * (low - 1) + 8, 8);
+    for(size_t recordSize; location < recordsSize && (recordSize = getRecordSize(mem + location, recordsSize - location)) != 0; location += recordSize)
+    {
+        time_t deviceTime = getRecordDeviceTime(mem + location);
+        if(deviceTime > endTime)
+            break;
+        if(deviceTime >= startTime && recordHasDevice(mem + location, deviceName))
+            fn(readRecordEvent(mem + location));
+    }
+}
+
+void EventPartitionFile::queryDirectory(string directory, const string & deviceName, time_t startTime, time_t endTime, function<void(const Event & event)> fn)
+{
+    DIR * dir = opendir(directory.c_str());
+    if(dir == nullptr)
+        throw IOException("IO Error : can't open " + directory + " : " + strerror(errno));
+    vector<pair<long long, string>> files;
+    while(dirent * entry = readdir(dir))
+    {
+        long long start;
+        char extension[8];
+        if(sscanf(entry->d_name, "partition-%lld.%7s", &start, extension) == 2 && string(extension) == "pce")
+            files.push_back(make_pair(start, directory + "/" + entry->d_name));
+    }
+    closedir(dir);
+    sort(files.begin(), files.end());
+    for(const pair<long long, string> & file : files)
+    {
+        EventPartitionFile partition(get<1>(file));
+        partition.query(deviceName, startTime, endTime, fn);
+    }
+}
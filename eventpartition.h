@@ -0,0 +1,108 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef EVENTPARTITION_H_INCLUDED
+#define EVENTPARTITION_H_INCLUDED
+
+#include "eventsink.h"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <functional>
+#include <cstdint>
+
+using namespace std;
+
+/** writes events into one file per receive time period. Events are appended to a pending file as they arrive,
+ * when the period ends the pending file is sorted by device time and written out with a footer holding
+ * a sparse device time index and a Bloom filter over the device names. Partitions are finished on a background
+ * thread. The writer only moves forward, late events go into the current partition, and a pending file
+ * for a partition that is already finished (from a clock step back across a restart) is merged into it.
+ *
+ * file layout (little endian) :
+ *   records sorted by device time : i64 device time, i64 receive time, u16 length + device name, u32 length + event text
+ *   footer : u32 record count, i64 min device time, i64 max device time, u32 index interval, u32 index entry count,
+ *            index entries (i64 device time, u64 record offset), u32 Bloom filter bit count, u32 Bloom filter hash count,
+ *            Bloom filter bits, u32 CRC-32 of the footer so far, u64 footer offset, "PCEVIDX" + NUL
+ */
+class EventPartitionWriter final : public EventSink
+{
+private:
+    mutex lock;
+    const string directory;
+    const time_t partitionDuration;
+    const size_t indexInterval;
+    time_t currentPartitionStart = 0;
+    int fd = -1;
+    mutex finishLock;
+    condition_variable finishCond;
+    deque<time_t> finishQueue;
+    bool done = false;
+    thread finishThread;
+    void openPartition(time_t start);
+    void queueFinishPartition();
+    void finishFn();
+public:
+    EventPartitionWriter(string directory, time_t partitionDuration, size_t indexInterval);
+    ~EventPartitionWriter();
+    virtual void writeEvents(const string & deviceName, const vector<Event> & events) override;
+    static string getPartitionFileName(string directory, time_t start);
+    /** sorts a pending partition file and writes the finished partition file, merging in the records of fileName if it exists */
+    static void finishPartition(string pendingFileName, string fileName, size_t indexInterval);
+};
+
+/** read access to a finished partition file through mmap
+ */
+class EventPartitionFile final
+{
+    EventPartitionFile(const EventPartitionFile &) = delete;
+    const EventPartitionFile & operator =(const EventPartitionFile &) = delete;
+private:
+    const uint8_t * mem = nullptr;
+    size_t size = 0;
+    size_t recordsSize = 0;
+    uint32_t recordCount = 0;
+    time_t minTime = 0, maxTime = 0;
+    const uint8_t * index = nullptr;
+    uint32_t indexCount = 0;
+    const uint8_t * bloomBits = nullptr;
+    uint32_t bloomBitCount = 0, bloomHashCount = 0;
+public:
+    explicit EventPartitionFile(string fileName);
+    ~EventPartitionFile();
+    time_t getMinTime() const
+    {
+        return minTime;
+    }
+    time_t getMaxTime() const
+    {
+        return maxTime;
+    }
+    uint32_t getRecordCount() const
+    {
+        return recordCount;
+    }
+    /** @return false if no events for deviceName are in this file, true if there might be */
+    bool mayContainDevice(const string & deviceName) const;
+    /** calls fn for the events of deviceName with startTime <= device time <= endTime, in device time order */
+    void query(const string & deviceName, time_t startTime, time_t endTime, function<void(const Event & event)> fn) const;
+    /** queries all the finished partition files in directory in partition order, skipping files by time range and Bloom filter */
+    static void queryDirectory(string directory, const string & deviceName, time_t startTime, time_t endTime, function<void(const Event & event)> fn);
+};
+
+#endif // EVENTPARTITION_H_INCLUDED
@@ -0,0 +1,547 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "eventseries.h"
+#include "stream.h"
+#include "checksum.h"
+#include "binaryio.h"
+#include <algorithm>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+namespace
+{
+const char segmentMagic[8] = {'P', 'C', 'E', 'V', 'S', 'E', 'R', '\0'};
+const size_t blockHeaderCheckedSize = 24;
+
+/** @return the number of bits needed for indexes into count entries */
+unsigned getIndexBitCount(size_t count)
+{
+    unsigned retval = 0;
+    while(((uint64_t)1 << retval) < count)
+        retval++;
+    return retval;
+}
+
+class BitWriter final
+{
+private:
+    string & buffer;
+    uint64_t bits = 0;
+    unsigned bitCount = 0;
+public:
+    explicit BitWriter(string & buffer)
+        : buffer(buffer)
+    {
+    }
+    /** @param value must fit in count bits, count can be up to 32 */
+    void write(uint32_t value, unsigned count)
+    {
+        bits |= (uint64_t)value << bitCount;
+        bitCount += count;
+        if(bitCount >= 32)
+        {
+            appendLittleEndian(buffer, bits, 4);
+            bits >>= 32;
+            bitCount -= 32;
+        }
+    }
+    void finish()
+    {
+        appendLittleEndian(buffer, bits, (bitCount + 7) / 8);
+        bits = 0;
+        bitCount = 0;
+    }
+};
+
+class BitReader final
+{
+private:
+    const uint8_t * next;
+    const uint8_t * const end;
+    uint64_t bits = 0;
+    unsigned bitCount = 0;
+public:
+    BitReader(const uint8_t * next, const uint8_t * end)
+        : next(next), end(end)
+    {
+    }
+    /** makes at least 32 bits available unless the stream ends first */
+    void refill()
+    {
+        if(bitCount >= 32)
+            return;
+        if(end - next >= 4)
+        {
+            bits |= readLittleEndian(next, 4) << bitCount;
+            next += 4;
+            bitCount += 32;
+            return;
+        }
+        while(next != end)
+        {
+            bits |= (uint64_t)*next++ << bitCount;
+            bitCount += 8;
+        }
+    }
+    /** @return the next bits without consuming them, the bits after the end of the stream are 0 */
+    uint32_t peek() const
+    {
+        return (uint32_t)bits;
+    }
+    void skip(unsigned count)
+    {
+        if(bitCount < count)
+            throw IOException("IO Error : truncated event series block");
+        bits >>= count;
+        bitCount -= count;
+    }
+    /** @param count can be up to 32 */
+    uint32_t read(unsigned count)
+    {
+        refill();
+        uint32_t retval = bits & (((uint64_t)1 << count) - 1);
+        skip(count);
+        return retval;
+    }
+};
+
+struct TimeState
+{
+    int64_t previous;
+    int64_t previousDelta = 0;
+    explicit TimeState(int64_t previous)
+        : previous(previous)
+    {
+    }
+};
+
+void writeTime(BitWriter & writer, int64_t value, TimeState & state)
+{
+    uint64_t delta = (uint64_t)value - (uint64_t)state.previous;
+    int64_t deltaOfDelta = (int64_t)(delta - (uint64_t)state.previousDelta);
+    uint64_t zigzag = ((uint64_t)deltaOfDelta << 1) ^ (uint64_t)(deltaOfDelta >> 63);
+    state.previous = value;
+    state.previousDelta = (int64_t)delta;
+    if(zigzag == 0)
+        writer.write(0, 1);
+    else if(zigzag < ((uint64_t)1 << 7))
+    {
+        writer.write(0x1, 2);
+        writer.write(zigzag, 7);
+    }
+    else if(zigzag < ((uint64_t)1 << 12))
+    {
+        writer.write(0x3, 3);
+        writer.write(zigzag, 12);
+    }
+    else if(zigzag < ((uint64_t)1 << 20))
+    {
+        writer.write(0x7, 4);
+        writer.write(zigzag, 20);
+    }
+    else if(zigzag < ((uint64_t)1 << 32))
+    {
+        writer.write(0xF, 5);
+        writer.write(zigzag, 32);
+    }
+    else
+    {
+        writer.write(0x1F, 5);
+        writer.write((uint32_t)zigzag, 32);
+        writer.write((uint32_t)(zigzag >> 32), 32);
+    }
+}
+
+int64_t readTime(BitReader & reader, TimeState & state)
+{
+    reader.refill();
+    // the prefix is up to 5 ones, ended by a zero unless there are 5
+    unsigned ones = __builtin_ctz(~reader.peek() | 0x20);
+    reader.skip(ones < 5 ? ones + 1 : ones);
+    uint64_t zigzag;
+    switch(ones)
+    {
+    case 0:
+        zigzag = 0;
+        break;
+    case 1:
+        zigzag = reader.read(7);
+        break;
+    case 2:
+        zigzag = reader.read(12);
+        break;
+    case 3:
+        zigzag = reader.read(20);
+        break;
+    case 4:
+        zigzag = reader.read(32);
+        break;
+    default:
+        zigzag = reader.read(32);
+        zigzag |= (uint64_t)reader.read(32) << 32;
+        break;
+    }
+    uint64_t deltaOfDelta = (zigzag >> 1) ^ (0 - (zigzag & 1));
+    uint64_t delta = (uint64_t)state.previousDelta + deltaOfDelta;
+    state.previous = (int64_t)((uint64_t)state.previous + delta);
+    state.previousDelta = (int64_t)delta;
+    return state.previous;
+}
+
+/** adds value to a block dictionary
+ * @return its index
+ */
+uint32_t getDictionaryIndex(unordered_map<string, uint32_t> & indexes, vector<const string *> & entries, const string & value)
+{
+    auto iter = indexes.find(value);
+    if(iter != indexes.end())
+        return iter->second;
+    uint32_t retval = entries.size();
+    indexes.emplace(value, retval);
+    entries.push_back(&value);
+    return retval;
+}
+}
+
+void EventSeriesWriter::encodeBlock(string & buffer, const vector<string> & deviceNames, const vector<Event> & events)
+{
+    unordered_map<string, uint32_t> deviceIndexes, textIndexes;
+    vector<const string *> devices, texts;
+    vector<uint32_t> deviceIds(events.size()), textCodes(events.size());
+    int64_t minTime = events.empty() ? 0 : events.front().deviceTime, maxTime = minTime;
+    for(size_t i = 0; i < events.size(); i++)
+    {
+        deviceIds[i] = getDictionaryIndex(deviceIndexes, devices, deviceNames[i]);
+        textCodes[i] = getDictionaryIndex(textIndexes, texts, events[i].text);
+        minTime = min<int64_t>(minTime, events[i].deviceTime);
+        maxTime = max<int64_t>(maxTime, events[i].deviceTime);
+    }
+    string body;
+    appendLittleEndian(body, devices.size(), 4);
+    for(const string * device : devices)
+    {
+        appendLittleEndian(body, min<size_t>(device->size(), 0xFFFF), 2);
+        body.append(*device, 0, 0xFFFF);
+    }
+    appendLittleEndian(body, texts.size(), 4);
+    for(const string * text : texts)
+    {
+        appendLittleEndian(body, text->size(), 4);
+        body += *text;
+    }
+    unsigned deviceBitCount = getIndexBitCount(devices.size()), textBitCount = getIndexBitCount(texts.size());
+    vector<TimeState> deviceTimeStates(devices.size(), TimeState(minTime));
+    TimeState receiveTimeState(minTime);
+    BitWriter writer(body);
+    for(size_t i = 0; i < events.size(); i++)
+    {
+        writer.write(deviceIds[i], deviceBitCount);
+        writer.write(textCodes[i], textBitCount);
+        writeTime(writer, events[i].deviceTime, deviceTimeStates[deviceIds[i]]);
+        writeTime(writer, events[i].receiveTime, receiveTimeState);
+    }
+    writer.finish();
+    size_t headerStart = buffer.size();
+    appendLittleEndian(buffer, body.size(), 4);
+    appendLittleEndian(buffer, events.size(), 4);
+    appendLittleEndian(buffer, (uint64_t)minTime, 8);
+    appendLittleEndian(buffer, (uint64_t)maxTime, 8);
+    uint32_t checkSum = crc32(buffer.data() + headerStart, blockHeaderCheckedSize);
+    appendLittleEndian(buffer, crc32(body.data(), body.size(), checkSum), 4);
+    buffer += body;
+}
+
+string EventSeriesWriter::getSegmentFileName(string directory, uint32_t number)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "series-%08X.pcz", (unsigned)number);
+    return directory + "/" + name;
+}
+
+vector<uint32_t> EventSeriesWriter::listSegments(string directory)
+{
+    vector<uint32_t> retval;
+    DIR * dir = opendir(directory.c_str());
+    if(dir == nullptr)
+        throw IOException("IO Error : can't open " + directory + " : " + strerror(errno));
+    while(dirent * entry = readdir(dir))
+    {
+        unsigned number;
+        char extension[8];
+        if(sscanf(entry->d_name, "series-%8X.%7s", &number, extension) == 2 && string(extension) == "pcz")
+            retval.push_back(number);
+    }
+    closedir(dir);
+    sort(retval.begin(), retval.end());
+    return retval;
+}
+
+EventSeriesWriter::EventSeriesWriter(string directory, size_t blockRowCount, time_t blockDuration, size_t segmentSize)
+    : directory(directory), blockRowCount(max<size_t>(blockRowCount, 1)), blockDuration(max<time_t>(blockDuration, 1)), segmentSize(segmentSize)
+{
+    mkdir(directory.c_str(), 0755);
+    vector<uint32_t> segments = listSegments(directory);
+    if(segments.empty())
+        createSegment(0);
+    else
+    {
+        // continue the last segment after cutting off a partially written block
+        uint32_t number = segments.back();
+        string fileName = getSegmentFileName(directory, number);
+        size_t validSize = EventSeriesFile(fileName).getValidSize();
+        if(validSize == 0)
+            createSegment(number + 1);
+        else
+        {
+            fd = open(fileName.c_str(), O_WRONLY | O_CLOEXEC);
+            if(fd == -1 || ftruncate(fd, validSize) == -1 || lseek(fd, validSize, SEEK_SET) == (off_t)-1)
+                throw IOException("IO Error : can't open " + fileName + " : " + strerror(errno));
+            segmentNumber = number;
+            segmentOffset = validSize;
+        }
+    }
+    flushThread = thread(&EventSeriesWriter::flushFn, this);
+}
+
+EventSeriesWriter::~EventSeriesWriter()
+{
+    flushLock.lock();
+    done = true;
+    flushCond.notify_all();
+    flushLock.unlock();
+    flushThread.join();
+    try
+    {
+        writeBlock();
+    }
+    catch(exception & e)
+    {
+        cerr << "Error : " << e.what() << endl;
+    }
+    if(fd != -1)
+        close(fd);
+}
+
+void EventSeriesWriter::createSegment(uint32_t number)
+{
+    if(fd != -1)
+        close(fd);
+    string fileName = getSegmentFileName(directory, number);
+    fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(fd == -1)
+        throw IOException("IO Error : can't create " + fileName + " : " + strerror(errno));
+    segmentNumber = number;
+    segmentOffset = 0;
+    string header(segmentMagic, sizeof(segmentMagic));
+    appendLittleEndian(header, Version, 4);
+    appendLittleEndian(header, number, 4);
+    appendLittleEndian(header, crc32(header.data(), header.size()), 4);
+    writeBuffer(header);
+}
+
+void EventSeriesWriter::writeBuffer(const string & buffer)
+{
+    const char * pbuffer = buffer.data();
+    size_t sizeLeft = buffer.size();
+    while(sizeLeft > 0)
+    {
+        ssize_t retval = ::write(fd, pbuffer, sizeLeft);
+        if(retval == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            throw IOException(string("IO Error : can't write to event series : ") + strerror(errno));
+        }
+        sizeLeft -= retval;
+        pbuffer += retval;
+        segmentOffset += retval;
+    }
+}
+
+void EventSeriesWriter::writeBlock()
+{
+    if(pendingEvents.empty())
+        return;
+    string buffer;
+    encodeBlock(buffer, pendingDeviceNames, pendingEvents);
+    pendingDeviceNames.clear();
+    pendingEvents.clear();
+    if(segmentOffset + buffer.size() > segmentSize && segmentOffset > HeaderSize)
+        createSegment(segmentNumber + 1);
+    writeBuffer(buffer);
+}
+
+void EventSeriesWriter::flushFn()
+{
+    // writes a block that has been pending for blockDuration even if no more events arrive
+    unique_lock<mutex> lockIt(flushLock);
+    while(!done)
+    {
+        flushCond.wait_for(lockIt, chrono::seconds(blockDuration));
+        if(done)
+            break;
+        lockIt.unlock();
+        try
+        {
+            lock_guard<mutex> lockWriter(lock);
+            if(!pendingEvents.empty() && time(NULL) - pendingStartTime >= blockDuration)
+                writeBlock();
+        }
+        catch(exception & e)
+        {
+            cerr << "Error : " << e.what() << endl;
+        }
+        lockIt.lock();
+    }
+}
+
+void EventSeriesWriter::writeEvents(const string & deviceName, const vector<Event> & events)
+{
+    lock_guard<mutex> lockIt(lock);
+    time_t now = time(NULL);
+    if(!pendingEvents.empty() && now - pendingStartTime >= blockDuration)
+        writeBlock();
+    for(const Event & event : events)
+    {
+        if(pendingEvents.empty())
+            pendingStartTime = now;
+        pendingDeviceNames.push_back(deviceName);
+        pendingEvents.push_back(event);
+        if(pendingEvents.size() >= blockRowCount)
+            writeBlock();
+    }
+}
+
+EventSeriesFile::EventSeriesFile(string fileName)
+{
+    int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1)
+        throw IOException("IO Error : can't open " + fileName + " : " + strerror(errno));
+    struct stat st;
+    if(fstat(fd, &st) == -1)
+    {
+        close(fd);
+        throw IOException("IO Error : can't stat " + fileName + " : " + strerror(errno));
+    }
+    if((size_t)st.st_size < EventSeriesWriter::HeaderSize)
+    {
+        close(fd);
+        return;
+    }
+    size = st.st_size;
+    void * pmem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pmem == MAP_FAILED)
+        throw IOException("IO Error : can't map " + fileName + " : " + strerror(errno));
+    mem = (const uint8_t *)pmem;
+    madvise(pmem, size, MADV_SEQUENTIAL);
+    if(memcmp(mem, segmentMagic, sizeof(segmentMagic)) != 0 || readLittleEndian(mem + 8, 4) != EventSeriesWriter::Version
+       || readLittleEndian(mem + 16, 4) != crc32(mem, 16))
+        return;
+    size_t location = EventSeriesWriter::HeaderSize;
+    while(size - location >= EventSeriesWriter::BlockHeaderSize)
+    {
+        const uint8_t * header = mem + location;
+        size_t bodySize = readLittleEndian(header, 4);
+        Block block;
+        block.offset = location;
+        block.rowCount = readLittleEndian(header + 4, 4);
+        block.minTime = (int64_t)readLittleEndian(header + 8, 8);
+        block.maxTime = (int64_t)readLittleEndian(header + 16, 8);
+        // every row takes at least 2 bits
+        if(size - location - EventSeriesWriter::BlockHeaderSize < bodySize || block.rowCount / 4 > bodySize)
+            break;
+        blocks.push_back(block);
+        location += EventSeriesWriter::BlockHeaderSize + bodySize;
+    }
+    validSize = location;
+}
+
+EventSeriesFile::~EventSeriesFile()
+{
+    if(mem != nullptr)
+        munmap((void *)mem, size);
+}
+
+size_t EventSeriesFile::getBlockSize(size_t block) const
+{
+    return EventSeriesWriter::BlockHeaderSize + readLittleEndian(mem + blocks[block].offset, 4);
+}
+
+void EventSeriesFile::decodeBlock(size_t block, EventSeriesBlock & rows) const
+{
+    const IOException damagedBlock("IO Error : damaged event series block");
+    const Block & info = blocks[block];
+    const uint8_t * header = mem + info.offset;
+    size_t bodySize = readLittleEndian(header, 4);
+    const uint8_t * next = header + EventSeriesWriter::BlockHeaderSize, * end = next + bodySize;
+    if(crc32(next, bodySize, crc32(header, blockHeaderCheckedSize)) != readLittleEndian(header + blockHeaderCheckedSize, 4))
+        throw damagedBlock;
+    auto readString = [&](size_t lengthSize, string & value)
+    {
+        if((size_t)(end - next) < lengthSize)
+            throw damagedBlock;
+        size_t length = readLittleEndian(next, lengthSize);
+        next += lengthSize;
+        if((size_t)(end - next) < length)
+            throw damagedBlock;
+        value.assign((const char *)next, length);
+        next += length;
+    };
+    vector<string> * dictionaries[2] = {&rows.deviceNames, &rows.texts};
+    const size_t lengthSizes[2] = {2, 4};
+    for(size_t i = 0; i < 2; i++)
+    {
+        if(end - next < 4)
+            throw damagedBlock;
+        size_t count = readLittleEndian(next, 4);
+        next += 4;
+        if(count > (size_t)(end - next) / lengthSizes[i] || (count == 0 && info.rowCount > 0))
+            throw damagedBlock;
+        dictionaries[i]->resize(count);
+        for(string & value : *dictionaries[i])
+            readString(lengthSizes[i], value);
+    }
+    size_t deviceCount = rows.deviceNames.size(), textCount = rows.texts.size();
+    unsigned deviceBitCount = getIndexBitCount(deviceCount), textBitCount = getIndexBitCount(textCount);
+    rows.deviceIds.resize(info.rowCount);
+    rows.textCodes.resize(info.rowCount);
+    rows.deviceTimes.resize(info.rowCount);
+    rows.receiveTimes.resize(info.rowCount);
+    vector<TimeState> deviceTimeStates(deviceCount, TimeState(info.minTime));
+    TimeState receiveTimeState(info.minTime);
+    BitReader reader(next, end);
+    for(size_t row = 0; row < info.rowCount; row++)
+    {
+        uint32_t deviceId = reader.read(deviceBitCount);
+        uint32_t textCode = reader.read(textBitCount);
+        if(deviceId >= deviceCount || textCode >= textCount)
+            throw damagedBlock;
+        rows.deviceIds[row] = deviceId;
+        rows.textCodes[row] = textCode;
+        rows.deviceTimes[row] = readTime(reader, deviceTimeStates[deviceId]);
+        rows.receiveTimes[row] = readTime(reader, receiveTimeState);
+    }
+}
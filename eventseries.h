@@ -0,0 +1,148 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef EVENTSERIES_H_INCLUDED
+#define EVENTSERIES_H_INCLUDED
+
+#include "eventsink.h"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+
+using namespace std;
+
+/** the decoded rows of one block, deviceIds and textCodes index the block's dictionaries */
+struct EventSeriesBlock
+{
+    vector<string> deviceNames;
+    vector<string> texts;
+    vector<uint32_t> deviceIds;
+    vector<uint32_t> textCodes;
+    vector<int64_t> deviceTimes;
+    vector<int64_t> receiveTimes;
+    size_t size() const
+    {
+        return deviceIds.size();
+    }
+};
+
+/** append-only compressed event log split into segment files of a bounded size. Events are collected into blocks of
+ * blockRowCount events, or fewer when events arrive blockDuration seconds after the block's first one, and every block
+ * is compressed on its own : device names and event texts become dictionary indexes of the fewest bits that fit the
+ * block's dictionaries, device times are stored as the delta of the delta from the same device's previous event and
+ * receive times as the delta of the delta from the previous row. Pending events are lost if the server is killed,
+ * the last segment is continued after cutting off a partially written block.
+ *
+ * segment layout (little endian) :
+ *   header : "PCEVSER" + NUL, u32 version, u32 segment number, u32 CRC-32 of the preceding header bytes
+ *   blocks : u32 body size, u32 row count, i64 least device time, i64 greatest device time,
+ *            u32 CRC-32 of the preceding block header bytes and the body, body
+ *   body : u32 device count, device names (u16 length + bytes), u32 text count, texts (u32 length + bytes),
+ *          then a bit stream, least significant bit first, with for every row : device index, text index,
+ *          device time, receive time
+ *   times : the delta of deltas d is zigzag encoded to z then written as
+ *           0 if z is 0, 10 + 7 bits, 110 + 12 bits, 1110 + 20 bits, 11110 + 32 bits or 11111 + 64 bits;
+ *           a device's first time in a block is relative to the least device time with a previous delta of 0,
+ *           the first receive time likewise
+ */
+class EventSeriesWriter final : public EventSink
+{
+private:
+    mutex lock;
+    const string directory;
+    const size_t blockRowCount;
+    const time_t blockDuration;
+    const size_t segmentSize;
+    uint32_t segmentNumber = 0;
+    int fd = -1;
+    size_t segmentOffset = 0;
+    vector<string> pendingDeviceNames;
+    vector<Event> pendingEvents;
+    time_t pendingStartTime = 0;
+    void createSegment(uint32_t number);
+    void writeBuffer(const string & buffer);
+    void writeBlock();
+    mutex flushLock;
+    condition_variable flushCond;
+    bool done = false;
+    thread flushThread;
+    void flushFn();
+public:
+    static const size_t HeaderSize = 20;
+    static const size_t BlockHeaderSize = 28;
+    static const uint32_t Version = 1;
+    EventSeriesWriter(string directory, size_t blockRowCount, time_t blockDuration, size_t segmentSize);
+    /** writes the pending events */
+    ~EventSeriesWriter();
+    virtual void writeEvents(const string & deviceName, const vector<Event> & events) override;
+    /** appends one compressed block of events to buffer */
+    static void encodeBlock(string & buffer, const vector<string> & deviceNames, const vector<Event> & events);
+    static string getSegmentFileName(string directory, uint32_t number);
+    /** @return the numbers of the segments in directory, in ascending order */
+    static vector<uint32_t> listSegments(string directory);
+};
+
+/** read access to a segment through mmap. The block headers are read when the segment is opened, stopping at the
+ * first incomplete block, the bodies are checked against their CRC when they're decoded.
+ */
+class EventSeriesFile final
+{
+    EventSeriesFile(const EventSeriesFile &) = delete;
+    const EventSeriesFile & operator =(const EventSeriesFile &) = delete;
+private:
+    struct Block
+    {
+        size_t offset;
+        uint32_t rowCount;
+        int64_t minTime, maxTime;
+    };
+    const uint8_t * mem = nullptr;
+    size_t size = 0;
+    size_t validSize = 0;
+    vector<Block> blocks;
+public:
+    explicit EventSeriesFile(string fileName);
+    ~EventSeriesFile();
+    /** @return the size of the header and the complete blocks, 0 if the header is damaged */
+    size_t getValidSize() const
+    {
+        return validSize;
+    }
+    size_t getBlockCount() const
+    {
+        return blocks.size();
+    }
+    uint32_t getRowCount(size_t block) const
+    {
+        return blocks[block].rowCount;
+    }
+    int64_t getMinTime(size_t block) const
+    {
+        return blocks[block].minTime;
+    }
+    int64_t getMaxTime(size_t block) const
+    {
+        return blocks[block].maxTime;
+    }
+    /** @return the size of the block including its header */
+    size_t getBlockSize(size_t block) const;
+    /** @throw IOException if the block is damaged */
+    void decodeBlock(size_t block, EventSeriesBlock & rows) const;
+};
+
+#endif // EVENTSERIES_H_INCLUDED
@@ -0,0 +1,54 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef EVENTSINK_H_INCLUDED
+#define EVENTSINK_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <ctime>
+
+using namespace std;
+
+struct Event
+{
+    time_t deviceTime; // the time stamp sent by the device
+    time_t receiveTime;
+    string text;
+    Event(time_t deviceTime, string text, time_t receiveTime = 0)
+        : deviceTime(deviceTime), receiveTime(receiveTime), text(move(text))
+    {
+    }
+};
+
+/** receives the events of every successful sync, called from the connection threads
+ */
+class EventSink
+{
+public:
+    EventSink()
+    {
+    }
+    EventSink(const EventSink &) = delete;
+    const EventSink & operator =(const EventSink &) = delete;
+    virtual ~EventSink()
+    {
+    }
+    virtual void writeEvents(const string & deviceName, const vector<Event> & events) = 0;
+};
+
+#endif // EVENTSINK_H_INCLUDED
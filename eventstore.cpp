@@ -0,0 +1,228 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "eventstore.h"
+#include "stream.h"
+#include "checksum.h"
+#include "binaryio.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace
+{
+const char segmentMagic[8] = {'P', 'C', 'E', 'V', 'S', 'E', 'G', '\0'};
+const size_t recordHeaderSize = 8;
+const size_t minPayloadSize = 8 + 8 + 2 + 4;
+
+void appendRecord(string & buffer, const string & deviceName, const Event & event)
+{
+    string payload;
+    payload.reserve(minPayloadSize + deviceName.size() + event.text.size());
+    appendLittleEndian(payload, (uint64_t)(int64_t)event.deviceTime, 8);
+    appendLittleEndian(payload, (uint64_t)(int64_t)event.receiveTime, 8);
+    appendLittleEndian(payload, min<size_t>(deviceName.size(), 0xFFFF), 2);
+    payload.append(deviceName, 0, 0xFFFF);
+    appendLittleEndian(payload, event.text.size(), 4);
+    payload += event.text;
+    appendLittleEndian(buffer, payload.size(), 4);
+    appendLittleEndian(buffer, crc32(payload.data(), payload.size()), 4);
+    buffer += payload;
+}
+}
+
+string EventStore::getSegmentFileName(string directory, uint32_t number)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "segment-%08X.pcs", (unsigned)number);
+    return directory + "/" + name;
+}
+
+vector<uint32_t> EventStore::listSegments(string directory)
+{
+    vector<uint32_t> retval;
+    DIR * dir = opendir(directory.c_str());
+    if(dir == nullptr)
+        throw IOException("IO Error : can't open " + directory + " : " + strerror(errno));
+    while(dirent * entry = readdir(dir))
+    {
+        unsigned number;
+        char extension[8];
+        if(sscanf(entry->d_name, "segment-%8X.%7s", &number, extension) == 2 && string(extension) == "pcs")
+            retval.push_back(number);
+    }
+    closedir(dir);
+    sort(retval.begin(), retval.end());
+    return retval;
+}
+
+size_t EventStore::readSegment(string fileName, function<void(const string & deviceName, const Event & event)> fn)
+{
+    ifstream is(fileName.c_str(), ios::binary);
+    if(!is)
+        throw IOException("IO Error : can't open " + fileName);
+    string contents((istreambuf_iterator<char>(is)), istreambuf_iterator<char>());
+    const uint8_t * bytes = (const uint8_t *)contents.data();
+    if(contents.size() < HeaderSize || memcmp(bytes, segmentMagic, sizeof(segmentMagic)) != 0)
+        return 0;
+    if(readLittleEndian(bytes + 8, 4) != Version || readLittleEndian(bytes + 28, 4) != crc32(bytes, 28))
+        return 0;
+    size_t location = HeaderSize;
+    while(contents.size() - location >= recordHeaderSize)
+    {
+        size_t payloadSize = readLittleEndian(bytes + location, 4);
+        uint32_t checkSum = readLittleEndian(bytes + location + 4, 4);
+        if(payloadSize < minPayloadSize || contents.size() - location - recordHeaderSize < payloadSize)
+            break;
+        const uint8_t * payload = bytes + location + recordHeaderSize;
+        if(crc32(payload, payloadSize) != checkSum)
+            break;
+        time_t deviceTime = (time_t)(int64_t)readLittleEndian(payload, 8);
+        time_t receiveTime = (time_t)(int64_t)readLittleEndian(payload + 8, 8);
+        size_t deviceNameSize = readLittleEndian(payload + 16, 2);
+        if(payloadSize < minPayloadSize + deviceNameSize)
+            break;
+        size_t textSize = readLittleEndian(payload + 18 + deviceNameSize, 4);
+        if(payloadSize != minPayloadSize + deviceNameSize + textSize)
+            break;
+        string deviceName((const char *)payload + 18, deviceNameSize);
+        fn(deviceName, Event(deviceTime, string((const char *)payload + 22 + deviceNameSize, textSize), receiveTime));
+        location += recordHeaderSize + payloadSize;
+    }
+    return location;
+}
+
+EventStore::EventStore(string directory, size_t segmentSize)
+    : directory(directory), segmentSize(segmentSize)
+{
+    mkdir(directory.c_str(), 0755);
+    vector<uint32_t> segments = listSegments(directory);
+    if(segments.empty())
+    {
+        createSegment(0);
+        return;
+    }
+    // continue the last segment after cutting off a partially written record
+    uint32_t number = segments.back();
+    string fileName = getSegmentFileName(directory, number);
+    size_t validSize = readSegment(fileName, [](const string &, const Event &)
+    {
+    });
+    if(validSize == 0)
+    {
+        createSegment(number + 1);
+        return;
+    }
+    fd = open(fileName.c_str(), O_WRONLY | O_CLOEXEC);
+    if(fd == -1 || ftruncate(fd, validSize) == -1 || lseek(fd, validSize, SEEK_SET) == (off_t)-1)
+        throw IOException("IO Error : can't open " + fileName + " : " + strerror(errno));
+    segmentNumber = number;
+    segmentOffset = validSize;
+}
+
+EventStore::~EventStore()
+{
+    if(fd != -1)
+        close(fd);
+}
+
+void EventStore::createSegment(uint32_t number)
+{
+    if(fd != -1)
+        close(fd);
+    string fileName = getSegmentFileName(directory, number);
+    fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(fd == -1)
+        throw IOException("IO Error : can't create " + fileName + " : " + strerror(errno));
+    segmentNumber = number;
+    segmentOffset = 0;
+    string header(segmentMagic, sizeof(segmentMagic));
+    appendLittleEndian(header, Version, 4);
+    appendLittleEndian(header, number, 4);
+    appendLittleEndian(header, (uint64_t)(int64_t)time(NULL), 8);
+    appendLittleEndian(header, 0, 4);
+    appendLittleEndian(header, crc32(header.data(), header.size()), 4);
+    try
+    {
+        writeBuffer(header);
+    }
+    catch(IOException & e)
+    {
+        // records must not follow a missing header, so the next write starts yet another segment
+        if(fd != -1)
+            close(fd);
+        fd = -1;
+        throw;
+    }
+}
+
+void EventStore::writeBuffer(const string & buffer)
+{
+    const size_t startOffset = segmentOffset;
+    const char * pbuffer = buffer.data();
+    size_t sizeLeft = buffer.size();
+    while(sizeLeft > 0)
+    {
+        ssize_t retval = ::write(fd, pbuffer, sizeLeft);
+        if(retval == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            string error = strerror(errno);
+            // cut off what was written of buffer, so a torn record doesn't hide the records after it from readSegment.
+            // If that fails too the next write starts a new segment.
+            if(ftruncate(fd, startOffset) == -1 || lseek(fd, startOffset, SEEK_SET) == (off_t)-1)
+            {
+                close(fd);
+                fd = -1;
+            }
+            segmentOffset = startOffset;
+            throw IOException("IO Error : can't write to event store : " + error);
+        }
+        sizeLeft -= retval;
+        pbuffer += retval;
+        segmentOffset += retval;
+    }
+}
+
+void EventStore::writeEvents(const string & deviceName, const vector<Event> & events)
+{
+    lock_guard<mutex> lockIt(lock);
+    if(fd == -1)
+        createSegment(segmentNumber + 1);
+    string buffer, record;
+    for(const Event & event : events)
+    {
+        record.clear();
+        appendRecord(record, deviceName, event);
+        if(segmentOffset + buffer.size() + record.size() > segmentSize && segmentOffset + buffer.size() > HeaderSize)
+        {
+            writeBuffer(buffer);
+            buffer.clear();
+            createSegment(segmentNumber + 1);
+        }
+        buffer += record;
+    }
+    writeBuffer(buffer);
+}
@@ -0,0 +1,60 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef EVENTSTORE_H_INCLUDED
+#define EVENTSTORE_H_INCLUDED
+
+#include "eventsink.h"
+#include <mutex>
+#include <functional>
+
+using namespace std;
+
+/** append-only store of binary event records split into segment files of a bounded size.
+ *
+ * segment layout (little endian) :
+ *   header : "PCEVSEG" + NUL, u32 version, u32 segment number, i64 creation time, u32 reserved, u32 CRC-32 of the preceding header bytes
+ *   records : u32 payload length, u32 CRC-32 of the payload, payload
+ *   payload : i64 device time, i64 receive time, u16 length + device name, u32 length + event text
+ */
+class EventStore final : public EventSink
+{
+private:
+    mutex lock;
+    const string directory;
+    const size_t segmentSize;
+    uint32_t segmentNumber = 0;
+    int fd = -1;
+    size_t segmentOffset = 0;
+    void createSegment(uint32_t number);
+    void writeBuffer(const string & buffer);
+public:
+    static const size_t HeaderSize = 32;
+    static const uint32_t Version = 1;
+    EventStore(string directory, size_t segmentSize);
+    ~EventStore();
+    virtual void writeEvents(const string & deviceName, const vector<Event> & events) override;
+    static string getSegmentFileName(string directory, uint32_t number);
+    /** @return the numbers of the segments in directory, in ascending order */
+    static vector<uint32_t> listSegments(string directory);
+    /** calls fn for every record in a segment file, stopping at the first damaged or incomplete record
+     * @return the size of the intact part of the file, 0 if the header is damaged
+     */
+    static size_t readSegment(string fileName, function<void(const string & deviceName, const Event & event)> fn);
+};
+
+#endif // EVENTSTORE_H_INCLUDED
@@ -0,0 +1,820 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "handler.h"
+#include "blockcrypt.h"
+#include "chacha20poly1305.h"
+#include "threadpool.h"
+#include "latencystats.h"
+#include "trace.h"
+#include "ratelimit.h"
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <algorithm>
+
+using namespace std;
+
+bool useInfoMessages = false;
+bool useEpochTimes = false;
+unique_ptr<DeviceRegistry> deviceRegistry;
+unique_ptr<EventDeduplicator> eventDeduplicator;
+unique_ptr<RateLimiter> sourceRateLimiter;
+unique_ptr<RateLimiter> deviceRateLimiter;
+shared_ptr<MemoryBudget> requestMemoryBudget;
+size_t requestSpillSize = 64 << 10;
+string spillDirectory = "/tmp";
+
+/** decrypts the blocks of one request in parallel on the shared thread pool, a window of blocks at a time
+ */
+class BlockDecryptor final
+{
+private:
+    const shared_ptr<const DecryptionKey> key; // before tasks, so it outlives them
+    deque<string> plainTexts; // deque so pointers stay valid when adding blocks
+    TaskGroup tasks;
+public:
+    explicit BlockDecryptor(shared_ptr<const DecryptionKey> key)
+        : key(key)
+    {
+    }
+    void add(BigUnsigned cipherText)
+    {
+        plainTexts.push_back(string());
+        string * pplainText = &plainTexts.back();
+        const DecryptionKey * pkey = key.get();
+        uint64_t traceId = TRACE_ID();
+        tasks.run([cipherText, pplainText, pkey, traceId]()
+        {
+            TRACE_SET_ID(traceId);
+            LatencyTimer timer(LatencyStage::Decrypt);
+            TRACE_SCOPE("decrypt");
+            *pplainText = decryptBlock(cipherText, pkey->exponent, pkey->modulus);
+        });
+    }
+    /** adds a block that's already decrypted */
+    void addPlainText(string plainText)
+    {
+        plainTexts.push_back(plainText);
+    }
+    /** @return the number of blocks added since the last flush */
+    size_t size() const
+    {
+        return plainTexts.size();
+    }
+    /** waits for the blocks added so far, passes their plain texts to fn in order and drops them
+     * @throw the first error from decrypting the blocks
+     */
+    void flush(const function<void(const string & plainText)> & fn)
+    {
+        {
+            LatencyTimer timer(LatencyStage::DecryptWait);
+            TRACE_SCOPE("decrypt-wait");
+            tasks.wait();
+        }
+        for(const string & plainText : plainTexts)
+            fn(plainText);
+        plainTexts.clear();
+    }
+};
+
+uint32_t readBigEndian(const string & str, size_t & location, size_t byteCount)
+{
+    if(location > str.size() || str.size() - location < byteCount)
+        throw runtime_error("unexpected end of request");
+    uint32_t retval = 0;
+    for(size_t i = 0; i < byteCount; i++)
+        retval = (retval << 8) | (uint8_t)str[location++];
+    return retval;
+}
+
+string readLengthPrefixed(const string & str, size_t & location)
+{
+    size_t length = readBigEndian(str, location, 2);
+    if(str.size() - location < length)
+        throw runtime_error("unexpected end of request");
+    string retval = str.substr(location, length);
+    location += length;
+    return retval;
+}
+
+/** @return if a whole length prefixed string starts at location */
+bool hasLengthPrefixed(const string & str, size_t location)
+{
+    if(location > str.size() || str.size() - location < 2)
+        return false;
+    size_t length = readBigEndian(str, location, 2);
+    return str.size() - location >= length;
+}
+
+/** parses the hex time stamp at the start of an event line the same way as istream >> hex :
+ * an optional sign and 0x prefix then hex digits up to the first other character.
+ * t is set to 0 if there aren't any digits and left alone if the time stamp is empty.
+ */
+void parseHexTimeStamp(const char * str, const char * end, time_t & t)
+{
+    if(str == end)
+        return;
+    bool negative = (*str == '-');
+    if(*str == '-' || *str == '+')
+        str++;
+    if(end - str > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X') && isxdigit((unsigned char)str[2]))
+        str += 2;
+    time_t retval = 0;
+    for(; str != end; str++)
+    {
+        char ch = *str;
+        unsigned digit;
+        if(ch >= '0' && ch <= '9')
+            digit = ch - '0';
+        else if(ch >= 'a' && ch <= 'f')
+            digit = ch - 'a' + 0xA;
+        else if(ch >= 'A' && ch <= 'F')
+            digit = ch - 'A' + 0xA;
+        else
+            break;
+        retval = retval * 0x10 + digit;
+    }
+    t = negative ? -retval : retval;
+}
+
+/** appends t formatted with strftime("%c"), or as seconds since the epoch if useEpochTimes is set.
+ * The last formatted time is cached per thread as event lines usually share time stamps.
+ */
+void appendTime(string & str, time_t t)
+{
+    static thread_local time_t cachedTime = 0;
+    static thread_local char cachedString[256];
+    static thread_local size_t cachedLength = 0;
+    if(cachedLength == 0 || cachedTime != t)
+    {
+        tm brokenDownTime;
+        if(useEpochTimes || localtime_r(&t, &brokenDownTime) == nullptr)
+            cachedLength = snprintf(cachedString, sizeof(cachedString), "%lld", (long long)t);
+        else
+            cachedLength = strftime(cachedString, sizeof(cachedString), "%c", &brokenDownTime);
+        cachedTime = t;
+    }
+    str.append(cachedString, cachedLength);
+}
+
+void skipToEnd(istream & is)
+{
+    char ch;
+    while(is.get(ch))
+    {
+    }
+}
+
+/** @throw runtime_error if the request stopped because reading failed, rather than at its end */
+void checkReadError(const ReaderIStream & is)
+{
+    if(!is.getReadError().empty())
+        throw runtime_error(is.getReadError());
+}
+
+/** @return why handling a request failed, preferring a read error over what it caused */
+string getErrorMessage(const ReaderIStream & is, const exception & e)
+{
+    return is.getReadError().empty() ? e.what() : is.getReadError();
+}
+
+/** reads block.size() bytes, taking them from the start of pending first
+ * @return if there were enough bytes
+ */
+bool readBlock(istream & is, string & pending, string & block)
+{
+    size_t pendingCount = min(pending.size(), block.size());
+    block.replace(0, pendingCount, pending, 0, pendingCount);
+    pending.erase(0, pendingCount);
+    if(pendingCount == block.size())
+        return true;
+    return static_cast<bool>(is.read(&block[pendingCount], block.size() - pendingCount));
+}
+
+/** @return the key that decrypts cipherText, the first block of an unkeyed request
+ * @param plainText set to the decrypted block
+ * @throw runtime_error if no key matches
+ */
+shared_ptr<const DecryptionKey> findKeyByTrial(const KeyRing & keyRing, const BigUnsigned & cipherText, string & plainText)
+{
+    LatencyTimer timer(LatencyStage::Decrypt);
+    TRACE_SCOPE("decrypt-trial");
+    shared_ptr<const DecryptionKey> retval = keyRing.findByTrial(cipherText, plainText);
+    if(!retval)
+        throw runtime_error("no key matches");
+    return retval;
+}
+
+/** reads and decrypts the first block of an unkeyed request with raw blocks, trying the keys by increasing block size
+ * @return the key that decrypts the block
+ * @param plainText set to the decrypted block
+ * @param pending set to the bytes read past the end of the block
+ * @throw runtime_error if no key matches
+ */
+shared_ptr<const DecryptionKey> readFirstBlockByTrial(istream & is, const KeyRing & keyRing, string & plainText, string & pending)
+{
+    LatencyTimer timer(LatencyStage::Decrypt);
+    TRACE_SCOPE("decrypt-trial");
+    vector<size_t> blockSizes;
+    for(const shared_ptr<const DecryptionKey> & key : keyRing.getKeys())
+        blockSizes.push_back(key->blockSize);
+    sort(blockSizes.begin(), blockSizes.end());
+    blockSizes.erase(unique(blockSizes.begin(), blockSizes.end()), blockSizes.end());
+    string block;
+    for(size_t blockSize : blockSizes)
+    {
+        size_t readCount = block.size();
+        block.resize(blockSize);
+        if(!is.read(&block[readCount], blockSize - readCount))
+            throw runtime_error("unexpected end of request");
+        shared_ptr<const DecryptionKey> key = keyRing.findByTrial(BigUnsigned::fromRawBytes((const uint8_t *)block.data(), blockSize), plainText, blockSize);
+        if(key)
+        {
+            pending = block.substr(blockSize);
+            return key;
+        }
+    }
+    throw runtime_error("no key matches");
+}
+
+/** splits the plain text of a request into the device name, the stats string and the events as it's decrypted,
+ * and passes on the events of every part, so only a line or field that continues in the next part is kept
+ */
+class EventParser final
+{
+private:
+    const bool isBinary;
+    string & messages;
+    const EventBatchFn & emitFn;
+    const time_t now;
+    string pending; // the start of a line or field that isn't complete yet
+    size_t fieldIndex = 0; // 0 for the device name, 1 for the stats string, then the events
+    string deviceName;
+    bool hasDeviceId = false;
+    uint32_t deviceId = 0;
+    EventDeduplicator::RequestState dedupState;
+    vector<Event> events;
+    size_t eventCount = 0, removedCount = 0;
+    uint64_t byteCount = 0;
+    bool isSyncRecorded = false;
+    void setDeviceName(string name)
+    {
+        if(deviceRateLimiter && !deviceRateLimiter->tryAcquire(name))
+            throw runtime_error(name + " : over the device rate limit");
+        deviceName = move(name);
+        if(useInfoMessages)
+            messages += "Info : " + deviceName + " : syncing\n";
+    }
+    uint32_t getDeviceId()
+    {
+        if(!hasDeviceId)
+        {
+            deviceId = deviceRegistry->intern(deviceName);
+            hasDeviceId = true;
+        }
+        return deviceId;
+    }
+    void addEventLine(const char * str, const char * end)
+    {
+        time_t t = now;
+        const char * splitPos = (const char *)memchr(str, ' ', end - str);
+        if(splitPos)
+        {
+            parseHexTimeStamp(str, splitPos, t);
+            str = splitPos + 1;
+        }
+        events.push_back(Event(t, string(str, end), now));
+    }
+    /** handles one line of a text request, without its '\n' */
+    void addLine(const char * str, const char * end)
+    {
+        if(fieldIndex == 0)
+            setDeviceName(string(str, end));
+        else if(fieldIndex > 1)
+            addEventLine(str, end);
+        fieldIndex++;
+    }
+    /** handles the complete fields at the start of pending, for binary requests */
+    void addFields()
+    {
+        size_t location = 0;
+        for(;;)
+        {
+            size_t fieldLocation = location;
+            time_t t = 0;
+            if(fieldIndex > 1)
+            {
+                if(pending.size() - location < 4)
+                    break;
+                t = readBigEndian(pending, location, 4);
+            }
+            if(!hasLengthPrefixed(pending, location))
+            {
+                location = fieldLocation;
+                break;
+            }
+            string text = readLengthPrefixed(pending, location);
+            // a line break would let the device forge log lines, text requests can't contain one either
+            if(fieldIndex != 1 && text.find('\n') != string::npos)
+                throw runtime_error(fieldIndex == 0 ? "line break in device name" : "line break in event text");
+            if(fieldIndex == 0)
+                setDeviceName(move(text));
+            else if(fieldIndex > 1)
+                events.push_back(Event(t, move(text), now));
+            fieldIndex++;
+        }
+        pending.erase(0, location);
+    }
+    /** formats the events parsed so far and passes them on */
+    void emit()
+    {
+        if(events.empty())
+            return;
+        {
+            LatencyTimer timer(LatencyStage::Format);
+            TRACE_SCOPE("format");
+            if(eventDeduplicator)
+                removedCount += eventDeduplicator->filter(getDeviceId(), events, dedupState);
+            messages.reserve(messages.size() + events.size() * (deviceName.size() + 48));
+            for(const Event & event : events)
+            {
+                byteCount += event.text.size();
+                messages.append("Event : ").append(deviceName).append(" : ");
+                appendTime(messages, event.deviceTime);
+                messages.append(" : ").append(event.text).append("\n");
+            }
+            eventCount += events.size();
+        }
+        if(!events.empty())
+            emitFn(deviceName, events, messages);
+        events.clear();
+    }
+public:
+    EventParser(bool isBinary, string & messages, const EventBatchFn & emitFn)
+        : isBinary(isBinary), messages(messages), emitFn(emitFn), now(time(NULL))
+    {
+    }
+    bool hasDeviceName() const
+    {
+        return fieldIndex > 0;
+    }
+    /** @return the number of events passed on so far */
+    size_t getEventCount() const
+    {
+        return eventCount;
+    }
+    /** parses the next part of the plain text and passes on the events completed by it
+     * @throw runtime_error if the device is over its rate limit
+     */
+    void add(const char * str, size_t size)
+    {
+        {
+            LatencyTimer timer(LatencyStage::Parse);
+            TRACE_SCOPE("parse");
+            if(isBinary)
+            {
+                pending.append(str, size);
+                addFields();
+            }
+            else
+            {
+                const char * end = str + size;
+                while(str != end)
+                {
+                    const char * lineEnd = (const char *)memchr(str, '\n', end - str);
+                    if(!lineEnd)
+                    {
+                        pending.append(str, end);
+                        break;
+                    }
+                    if(pending.empty())
+                        addLine(str, lineEnd);
+                    else
+                    {
+                        pending.append(str, lineEnd);
+                        addLine(pending.data(), pending.data() + pending.size());
+                        pending.clear();
+                    }
+                    str = lineEnd + 1;
+                }
+            }
+        }
+        emit();
+    }
+    /** parses the rest of the plain text, passes on the last events and records the sync
+     * @throw runtime_error if the plain text ended early
+     */
+    void finish()
+    {
+        {
+            LatencyTimer timer(LatencyStage::Parse);
+            TRACE_SCOPE("parse");
+            if(isBinary)
+            {
+                if(fieldIndex < 2 || !pending.empty())
+                    throw runtime_error("unexpected end of request");
+            }
+            else
+            {
+                if(fieldIndex == 0)
+                    throw runtime_error("can't find device name");
+                // a last line without '\n' is an event, even in place of the stats string
+                if(!pending.empty())
+                    addEventLine(pending.data(), pending.data() + pending.size());
+                pending.clear();
+            }
+        }
+        emit();
+        recordSync();
+    }
+    /** records the events passed on so far in the device registry, once */
+    void recordSync()
+    {
+        if(!deviceRegistry || !hasDeviceName() || isSyncRecorded)
+            return;
+        isSyncRecorded = true;
+        if(useInfoMessages && removedCount > 0)
+            messages += "Info : " + deviceName + " : dropped " + to_string(removedCount) + " retransmitted events\n";
+        deviceRegistry->recordSync(getDeviceId(), now, eventCount, byteCount);
+    }
+};
+
+/** @return how many blocks to decrypt before parsing them : one until the device name is known if devices are rate limited,
+ * so no more is decrypted for a device over its limit
+ */
+size_t getDecryptWindowSize(const EventParser & parser)
+{
+    if(deviceRateLimiter && !parser.hasDeviceName())
+        return 1;
+    return max<size_t>(ThreadPool::shared().threadCount() * 2, 1);
+}
+
+/** reads up to size bytes, fewer only at the end
+ * @return the number of bytes read
+ */
+size_t readPart(Reader & reader, uint8_t * buffer, size_t size)
+{
+    size_t readCount = 0;
+    try
+    {
+        for(; readCount < size; readCount++)
+            buffer[readCount] = reader.readByte();
+    }
+    catch(EOFException & e)
+    {
+    }
+    return readCount;
+}
+
+void connectionHandler(ReaderIStream & is, WriterOStream & os, const string & sourceAddress, string & messages, const EventBatchFn & emitFn)
+{
+    /* Ciphertext blocks are handed to the decryptor as they are read and parsed a window at a time,
+     * so memory use is bounded by the window rather than the request.
+     * Session key payloads are buffered, spilling to a file when large, as their tag is checked before anything is parsed.
+     * On errors the rest of the request is still read so the client gets the response.
+     * Sources over their budget are refused before any decryption, devices as soon as their name is parsed.
+     */
+    char type;
+    const shared_ptr<const KeyRing> keyRing = getKeyRing();
+    const chrono::steady_clock::time_point readStartTime = chrono::steady_clock::now();
+    if(sourceRateLimiter && !sourceRateLimiter->tryAcquire(sourceAddress))
+    {
+        skipToEnd(is);
+        is.close();
+        messages += "Error : " + sourceAddress + " : over the source rate limit\n";
+        os << "0";
+        return;
+    }
+    if(!is.get(type))
+    {
+        is.close();
+        messages += "Error : Invalid request\n";
+        os << "0";
+        return;
+    }
+    /* keyed requests ('4' to '6') are requests '1' to '3' with the u32 big endian id of their key after the type byte.
+     * Unkeyed encrypted requests use the only key, or find theirs by trial decryption of the first block if there are several.
+     */
+    char baseType = type;
+    string additionalData(1, type);
+    shared_ptr<const DecryptionKey> key;
+    if(type >= '4' && type <= '6')
+    {
+        baseType = type - ('4' - '1');
+        string keyId(4, '\0');
+        size_t location = 0;
+        if(is.read(&keyId[0], keyId.size()) && keyRing)
+            key = keyRing->find(readBigEndian(keyId, location, 4));
+        if(keyRing && !key)
+        {
+            skipToEnd(is);
+            is.close();
+            messages += "Error : unknown key id\n";
+            os << "0";
+            return;
+        }
+        additionalData += keyId;
+    }
+    else if(keyRing && keyRing->getKeys().size() == 1)
+        key = keyRing->getKeys().front();
+    EventParser parser(baseType == '2', messages, emitFn);
+    auto parse = [&parser](const string & plainText)
+    {
+        parser.add(plainText.data(), plainText.size());
+    };
+    try
+    {
+        switch(baseType)
+        {
+        case '0': // unencrypted
+        {
+            if(keyRing)
+            {
+                skipToEnd(is);
+                checkReadError(is);
+                throw runtime_error("unencrypted message attempted");
+            }
+            char buffer[4096];
+            while(is.read(buffer, sizeof(buffer)) || is.gcount() > 0)
+                parser.add(buffer, is.gcount());
+            checkReadError(is);
+            recordLatency(LatencyStage::Read, chrono::steady_clock::now() - readStartTime);
+            TRACE_SPAN("read", readStartTime);
+            break;
+        }
+        case '1': // encrypted
+        {
+            if(!keyRing)
+                throw runtime_error("encrypted message attempted without key");
+            unique_ptr<BlockDecryptor> decryptor;
+            if(key)
+                decryptor.reset(new BlockDecryptor(key));
+            string line;
+            char ch;
+            while(is.get(ch))
+            {
+                if(ch != '\n')
+                {
+                    line += ch;
+                    continue;
+                }
+                BigUnsigned cipherText;
+                {
+                    LatencyTimer timer(LatencyStage::Base64);
+                    TRACE_SCOPE("base64");
+                    cipherText = BigUnsigned::parseBase64(line);
+                }
+                if(decryptor)
+                    decryptor->add(cipherText);
+                else
+                {
+                    string plainText;
+                    decryptor.reset(new BlockDecryptor(findKeyByTrial(*keyRing, cipherText, plainText)));
+                    decryptor->addPlainText(plainText);
+                }
+                if(decryptor->size() >= getDecryptWindowSize(parser))
+                    decryptor->flush(parse);
+                line.clear();
+            }
+            checkReadError(is);
+            recordLatency(LatencyStage::Read, chrono::steady_clock::now() - readStartTime);
+            TRACE_SPAN("read", readStartTime);
+            if(decryptor)
+                decryptor->flush(parse);
+            break;
+        }
+        case '2': // encrypted, binary framing
+        {
+            /* layout : u32 block count, then that many big endian blocks of the key's block size each.
+             * The decrypted blocks are concatenated and hold : u16 length + device name, u16 length + stats string,
+             * then (u32 time stamp, u16 length + event text) until the end. All integers are big endian.
+             */
+            if(!keyRing)
+                throw runtime_error("binary message attempted without key");
+            string header(4, '\0');
+            if(!is.read(&header[0], header.size()))
+                throw runtime_error("unexpected end of request");
+            size_t location = 0;
+            size_t blockCount = readBigEndian(header, location, 4);
+            string pending, firstPlainText;
+            size_t firstBlock = 0;
+            if(!key && blockCount > 0)
+            {
+                key = readFirstBlockByTrial(is, *keyRing, firstPlainText, pending);
+                firstBlock = 1;
+            }
+            BlockDecryptor decryptor(key);
+            if(firstBlock > 0)
+                decryptor.addPlainText(firstPlainText);
+            string block(key ? key->blockSize : 0, '\0');
+            for(size_t i = firstBlock; i < blockCount; i++)
+            {
+                if(decryptor.size() >= getDecryptWindowSize(parser))
+                    decryptor.flush(parse);
+                if(!readBlock(is, pending, block))
+                    throw runtime_error("block count doesn't match request size");
+                decryptor.add(BigUnsigned::fromRawBytes((const uint8_t *)block.data(), block.size()));
+            }
+            char ch;
+            if(!pending.empty() || is.get(ch))
+                throw runtime_error("block count doesn't match request size");
+            checkReadError(is);
+            recordLatency(LatencyStage::Read, chrono::steady_clock::now() - readStartTime);
+            TRACE_SPAN("read", readStartTime);
+            decryptor.flush(parse);
+            break;
+        }
+        case '3': // encrypted session key, ChaCha20-Poly1305 payload
+        {
+            /* layout : one big endian block of the key's block size holding the session key followed by the nonce,
+             * then the ChaCha20-Poly1305 encrypted payload in the same layout as unencrypted requests,
+             * then the authentication tag. The type byte and key id are the additional authenticated data.
+             */
+            const size_t sessionKeySize = ChaCha20Poly1305::KeySize + ChaCha20Poly1305::NonceSize;
+            if(!keyRing)
+                throw runtime_error("session key message attempted without key");
+            string pending, firstPlainText;
+            bool isFoundByTrial = false;
+            if(!key)
+            {
+                key = readFirstBlockByTrial(is, *keyRing, firstPlainText, pending);
+                isFoundByTrial = true;
+            }
+            BlockDecryptor decryptor(key);
+            if(isFoundByTrial)
+                decryptor.addPlainText(firstPlainText);
+            else
+            {
+                string block(key->blockSize, '\0');
+                if(!is.read(&block[0], block.size()))
+                    throw runtime_error("unexpected end of request");
+                decryptor.add(BigUnsigned::fromRawBytes((const uint8_t *)block.data(), block.size()));
+            }
+            // the cipher text goes to payload, holding back the last bytes read as they may be the tag
+            SpillBuffer payload(requestMemoryBudget, requestSpillSize, spillDirectory);
+            string tag = pending;
+            char buffer[4096];
+            while(is.read(buffer, sizeof(buffer)) || is.gcount() > 0)
+            {
+                tag.append(buffer, is.gcount());
+                if(tag.size() > ChaCha20Poly1305::TagSize)
+                {
+                    payload.append(tag.data(), tag.size() - ChaCha20Poly1305::TagSize);
+                    tag.erase(0, tag.size() - ChaCha20Poly1305::TagSize);
+                }
+            }
+            checkReadError(is);
+            if(tag.size() < ChaCha20Poly1305::TagSize)
+                throw runtime_error("unexpected end of request");
+            recordLatency(LatencyStage::Read, chrono::steady_clock::now() - readStartTime);
+            TRACE_SPAN("read", readStartTime);
+            string sessionKey;
+            decryptor.flush([&sessionKey](const string & plainText)
+            {
+                sessionKey += plainText;
+            });
+            if(sessionKey.size() != sessionKeySize)
+                throw runtime_error("invalid session key size");
+            const uint8_t * pkey = (const uint8_t *)sessionKey.data();
+            ChaCha20Poly1305 cipher(pkey, pkey + ChaCha20Poly1305::KeySize);
+            shared_ptr<Reader> reader = payload.preader();
+            {
+                LatencyTimer timer(LatencyStage::Decrypt);
+                TRACE_SCOPE("decrypt");
+                cipher.verify([reader](uint8_t * part, size_t size)
+                {
+                    return readPart(*reader, part, size);
+                }, (const uint8_t *)tag.data(), additionalData);
+            }
+            reader = payload.preader();
+            uint8_t part[4096];
+            uint64_t offset = 0;
+            for(size_t size; (size = readPart(*reader, part, sizeof(part))) > 0; offset += size)
+            {
+                cipher.decryptPart(part, size, offset);
+                parser.add((const char *)part, size);
+            }
+            break;
+        }
+        default:
+            throw runtime_error("Invalid encryption type");
+        }
+        is.close();
+        parser.finish();
+    }
+    catch(exception & e)
+    {
+        skipToEnd(is);
+        is.close();
+        if(parser.getEventCount() > 0)
+            parser.recordSync();
+        messages += "Error : " + getErrorMessage(is, e) + "\n";
+        os << "0";
+        return;
+    }
+    os << "1";
+    os.close();
+}
+
+void connectionHandler(ReaderIStream & is, WriterOStream & os, const string & sourceAddress, string & messages, string & deviceName, vector<Event> & events)
+{
+    deviceName.clear();
+    events.clear();
+    connectionHandler(is, os, sourceAddress, messages, [&deviceName, &events](const string & batchDeviceName, vector<Event> & batch, string &)
+    {
+        deviceName = batchDeviceName;
+        events.insert(events.end(), make_move_iterator(batch.begin()), make_move_iterator(batch.end()));
+    });
+}
+
+void connectionHandler(ReaderIStream & is, WriterOStream & os, string & messages)
+{
+    string deviceName;
+    vector<Event> events;
+    connectionHandler(is, os, string(), messages, deviceName, events);
+}
+
+void readRequestHead(Reader & reader, string & head)
+{
+    head.clear();
+    try
+    {
+        char type = reader.readByte();
+        head += type;
+        char baseType = type;
+        if(type >= '4' && type <= '6')
+        {
+            baseType = type - ('4' - '1');
+            for(size_t i = 0; i < 4; i++)
+                head += (char)reader.readByte();
+        }
+        if(baseType == '1')
+        {
+            char ch;
+            do
+            {
+                ch = reader.readByte();
+                head += ch;
+            }
+            while(ch != '\n');
+        }
+        else if(baseType == '2')
+        {
+            for(size_t i = 0; i < 4; i++)
+                head += (char)reader.readByte();
+        }
+    }
+    catch(EOFException & e)
+    {
+    }
+}
+
+size_t estimateRequestCost(const string & head, size_t remainingSize)
+{
+    if(head.empty())
+        return 0;
+    size_t location = 1;
+    switch(head[0])
+    {
+    case '4':
+        location += 4;
+        // fall through
+    case '1':
+    {
+        // the lines of a request are about as long as its first one
+        size_t lineSize = head.size() - min(location, head.size());
+        if(lineSize == 0 || head.back() != '\n')
+            return 0;
+        return 1 + remainingSize / lineSize;
+    }
+    case '5':
+        location += 4;
+        // fall through
+    case '2':
+        if(head.size() - min(location, head.size()) < 4)
+            return 0;
+        // a request can't have more blocks than bytes, whatever it claims
+        return min<size_t>(readBigEndian(head, location, 4), remainingSize);
+    case '3':
+    case '6':
+        return 1;
+    default:
+        return 0;
+    }
+}
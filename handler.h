@@ -0,0 +1,69 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef HANDLER_H_INCLUDED
+#define HANDLER_H_INCLUDED
+
+#include "bigmath.h"
+#include "stream.h"
+#include "eventsink.h"
+#include "eventdedup.h"
+#include "deviceregistry.h"
+#include "decryptionkey.h"
+#include "ratelimit.h"
+#include "memorybudget.h"
+#include <memory>
+#include <vector>
+#include <string>
+#include <functional>
+
+using namespace std;
+
+extern bool useInfoMessages;
+extern bool useEpochTimes;
+extern unique_ptr<DeviceRegistry> deviceRegistry; // null to skip device bookkeeping
+extern unique_ptr<EventDeduplicator> eventDeduplicator; // null to keep retransmitted events, needs deviceRegistry
+extern unique_ptr<RateLimiter> sourceRateLimiter; // keyed by source address, null to not limit
+extern unique_ptr<RateLimiter> deviceRateLimiter; // keyed by device name, null to not limit
+extern shared_ptr<MemoryBudget> requestMemoryBudget; // shared by the buffers of requests in flight, null to not limit
+extern size_t requestSpillSize; // the most bytes of a request buffered in memory before the rest goes to a file
+extern string spillDirectory;
+
+/** receives the events of a request as they are parsed, a batch at a time, along with the log lines so far, which it may take */
+typedef function<void(const string & deviceName, vector<Event> & events, string & messages)> EventBatchFn;
+
+/** reads one request from is, decrypts and parses it, and writes the acknowledgement to os.
+ * The events are passed to emitFn a decrypted block at a time, so a request that fails part way may have emitted some already.
+ * Log lines are appended to messages. The request is decrypted with the key current when it starts, even if the key is replaced meanwhile.
+ * @param sourceAddress the client's address, for sourceRateLimiter
+ */
+void connectionHandler(ReaderIStream & is, WriterOStream & os, const string & sourceAddress, string & messages, const EventBatchFn & emitFn);
+/** handles a request like above, collecting all of its events in events */
+void connectionHandler(ReaderIStream & is, WriterOStream & os, const string & sourceAddress, string & messages, string & deviceName, vector<Event> & events);
+void connectionHandler(ReaderIStream & is, WriterOStream & os, string & messages);
+
+/** reads the start of a request : the type, the key id, and the first line or the block count, as far as they go.
+ * @param head set to the bytes read, which are still to be handled
+ * @throw IOException if reading fails other than by reaching the end
+ */
+void readRequestHead(Reader & reader, string & head);
+/** @return an estimate of the work for a request : the number of RSA blocks in it,
+ * judged from its head and the number of bytes after it
+ */
+size_t estimateRequestCost(const string & head, size_t remainingSize);
+
+#endif // HANDLER_H_INCLUDED
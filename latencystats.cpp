@@ -0,0 +1,264 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "latencystats.h"
+#include "stream.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cerrno>
+#include <csignal>
+
+using namespace std;
+
+namespace
+{
+const unsigned SubBucketBits = 4;
+const size_t SubBucketCount = 1 << SubBucketBits;
+const size_t BucketCount = (64 - SubBucketBits + 1) * SubBucketCount;
+
+/** values below SubBucketCount get their own bucket, larger values keep their top SubBucketBits + 1 bits */
+size_t getBucketIndex(uint64_t v)
+{
+    if(v < SubBucketCount)
+        return v;
+    unsigned exponent = 63 - __builtin_clzll(v); // >= SubBucketBits
+    unsigned shift = exponent - SubBucketBits;
+    return (shift + 1) * SubBucketCount + ((v >> shift) & (SubBucketCount - 1));
+}
+
+/** @return the largest value in bucket index */
+uint64_t getBucketMax(size_t index)
+{
+    if(index < SubBucketCount)
+        return index;
+    unsigned shift = index / SubBucketCount - 1;
+    uint64_t start = (uint64_t)(SubBucketCount + index % SubBucketCount) << shift;
+    return start + ((uint64_t)1 << shift) - 1;
+}
+
+struct Histogram
+{
+    atomic<uint64_t> counts[BucketCount];
+    atomic<uint64_t> maxValue;
+    Histogram()
+        : maxValue(0)
+    {
+        for(atomic<uint64_t> & count : counts)
+            count.store(0, memory_order_relaxed);
+    }
+    /** only called by the owning thread : relaxed loads and stores compile to plain moves */
+    void add(uint64_t v)
+    {
+        atomic<uint64_t> & count = counts[getBucketIndex(v)];
+        count.store(count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        if(v > maxValue.load(memory_order_relaxed))
+            maxValue.store(v, memory_order_relaxed);
+    }
+};
+
+struct ThreadHistograms
+{
+    Histogram stages[LatencyStageCount];
+};
+
+mutex threadsLock;
+vector<ThreadHistograms *> threads;
+uint64_t retiredCounts[LatencyStageCount][BucketCount]; // from threads that exited
+uint64_t retiredMax[LatencyStageCount];
+
+/** registers the thread's histograms on first use and folds them into the retired totals when the thread exits */
+struct ThreadHistogramsHolder final
+{
+    unique_ptr<ThreadHistograms> histograms;
+    ThreadHistogramsHolder()
+        : histograms(new ThreadHistograms)
+    {
+        lock_guard<mutex> lockIt(threadsLock);
+        threads.push_back(histograms.get());
+    }
+    ~ThreadHistogramsHolder()
+    {
+        lock_guard<mutex> lockIt(threadsLock);
+        threads.erase(find(threads.begin(), threads.end(), histograms.get()));
+        for(size_t stage = 0; stage < LatencyStageCount; stage++)
+        {
+            const Histogram & histogram = histograms->stages[stage];
+            for(size_t i = 0; i < BucketCount; i++)
+                retiredCounts[stage][i] += histogram.counts[i].load(memory_order_relaxed);
+            retiredMax[stage] = max(retiredMax[stage], histogram.maxValue.load(memory_order_relaxed));
+        }
+    }
+};
+
+/** @return the upper end of the bucket holding the fraction percentile, not above maxValue */
+uint64_t getPercentile(const vector<uint64_t> & counts, uint64_t total, uint64_t maxValue, double fraction)
+{
+    uint64_t rank = (uint64_t)(fraction * total);
+    if(rank >= total)
+        rank = total - 1;
+    uint64_t seen = 0;
+    for(size_t i = 0; i < counts.size(); i++)
+    {
+        seen += counts[i];
+        if(seen > rank)
+            return min(getBucketMax(i), maxValue);
+    }
+    return 0;
+}
+}
+
+const char * getLatencyStageName(LatencyStage stage)
+{
+    switch(stage)
+    {
+    case LatencyStage::Request:
+        return "request";
+    case LatencyStage::Receive:
+        return "receive";
+    case LatencyStage::Queue:
+        return "queue";
+    case LatencyStage::Read:
+        return "read";
+    case LatencyStage::Base64:
+        return "base64";
+    case LatencyStage::Decrypt:
+        return "decrypt";
+    case LatencyStage::DecryptWait:
+        return "decrypt-wait";
+    case LatencyStage::Parse:
+        return "parse";
+    case LatencyStage::Format:
+        return "format";
+    case LatencyStage::Sinks:
+        return "sinks";
+    case LatencyStage::Log:
+        return "log";
+    case LatencyStage::LogFlush:
+        return "log-flush";
+    }
+    return "unknown";
+}
+
+void recordLatency(LatencyStage stage, chrono::steady_clock::duration duration)
+{
+    static thread_local ThreadHistogramsHolder holder;
+    int64_t nanoseconds = chrono::duration_cast<chrono::nanoseconds>(duration).count();
+    holder.histograms->stages[(size_t)stage].add(nanoseconds < 0 ? 0 : nanoseconds);
+}
+
+string formatLatencyStats()
+{
+    vector<uint64_t> counts[LatencyStageCount];
+    uint64_t maxValues[LatencyStageCount];
+    {
+        lock_guard<mutex> lockIt(threadsLock);
+        for(size_t stage = 0; stage < LatencyStageCount; stage++)
+        {
+            counts[stage].assign(retiredCounts[stage], retiredCounts[stage] + BucketCount);
+            maxValues[stage] = retiredMax[stage];
+            for(const ThreadHistograms * thread : threads)
+            {
+                const Histogram & histogram = thread->stages[stage];
+                for(size_t i = 0; i < BucketCount; i++)
+                    counts[stage][i] += histogram.counts[i].load(memory_order_relaxed);
+                maxValues[stage] = max(maxValues[stage], histogram.maxValue.load(memory_order_relaxed));
+            }
+        }
+    }
+    string retval = "stage count p50_us p99_us p999_us max_us\n";
+    for(size_t stage = 0; stage < LatencyStageCount; stage++)
+    {
+        uint64_t total = 0;
+        for(uint64_t count : counts[stage])
+            total += count;
+        char line[256];
+        if(total == 0)
+            snprintf(line, sizeof(line), "%s 0 - - - -\n", getLatencyStageName((LatencyStage)stage));
+        else
+            snprintf(line, sizeof(line), "%s %llu %.1f %.1f %.1f %.1f\n", getLatencyStageName((LatencyStage)stage), (unsigned long long)total,
+                     getPercentile(counts[stage], total, maxValues[stage], 0.5) / 1000.0, getPercentile(counts[stage], total, maxValues[stage], 0.99) / 1000.0,
+                     getPercentile(counts[stage], total, maxValues[stage], 0.999) / 1000.0, maxValues[stage] / 1000.0);
+        retval += line;
+    }
+    return retval;
+}
+
+namespace
+{
+void writeLatencyStats(const string & fileName)
+{
+    string stats = formatLatencyStats();
+    if(fileName == "")
+    {
+        cerr << stats << flush;
+        return;
+    }
+    string tempFileName = fileName + ".tmp";
+    FILE * f = fopen(tempFileName.c_str(), "w");
+    if(f == nullptr)
+        throw IOException("IO Error : can't create " + tempFileName + " : " + strerror(errno));
+    bool failed = (fwrite(stats.data(), 1, stats.size(), f) != stats.size());
+    if(fclose(f) != 0 || failed)
+        throw IOException("IO Error : can't write to " + tempFileName);
+    if(rename(tempFileName.c_str(), fileName.c_str()) == -1)
+        throw IOException("IO Error : can't rename " + tempFileName + " : " + strerror(errno));
+}
+}
+
+void startLatencyStatsExport(string fileName, chrono::seconds interval)
+{
+    sigset_t signals, allSignals, oldSignals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    // the export thread starts with all signals blocked so it only gets the ones it waits for
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_SETMASK, &allSignals, &oldSignals);
+    thread([fileName, interval, signals]()
+    {
+        for(;;)
+        {
+            if(interval.count() > 0)
+            {
+                timespec timeout = {(time_t)interval.count(), 0};
+                if(sigtimedwait(&signals, nullptr, &timeout) == -1 && errno != EAGAIN)
+                    continue; // interrupted
+            }
+            else
+            {
+                int signal;
+                if(sigwait(&signals, &signal) != 0)
+                    continue;
+            }
+            try
+            {
+                writeLatencyStats(fileName);
+            }
+            catch(exception & e)
+            {
+                cerr << "Error : " << e.what() << endl;
+            }
+        }
+    }).detach();
+    sigaddset(&oldSignals, SIGUSR1);
+    pthread_sigmask(SIG_SETMASK, &oldSignals, nullptr);
+}
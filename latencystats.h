@@ -0,0 +1,83 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef LATENCYSTATS_H_INCLUDED
+#define LATENCYSTATS_H_INCLUDED
+
+#include <chrono>
+#include <string>
+
+using namespace std;
+
+/** the request processing stages that latencies are recorded for */
+enum class LatencyStage
+{
+    Request, // the whole connection, from accepting it to queueing the log messages
+    Receive, // receiving the request before it's scheduled
+    Queue, // waiting in the scheduler
+    Read, // reading the received request, including base 64 parsing, handing out blocks and parsing the ones decrypted meanwhile
+    Base64, // parsing one base 64 line
+    Decrypt, // decrypting one block
+    DecryptWait, // waiting for a window of blocks to be decrypted
+    Parse, // splitting a part of the plain text into events
+    Format, // formatting the log messages of a batch of events
+    Sinks, // writing a batch of events to the event sinks
+    Log, // queueing the log messages of a batch
+    LogFlush, // writing a batch to the log file
+    Last = LogFlush
+};
+
+const size_t LatencyStageCount = (size_t)LatencyStage::Last + 1;
+
+/** @return the name of stage used in the export */
+const char * getLatencyStageName(LatencyStage stage);
+
+/** records a duration for stage in the calling thread's histogram.
+ * Histograms are log bucketed with 1/16 relative precision and only written by their own thread,
+ * so recording doesn't use any locked instructions. They are merged when exported.
+ */
+void recordLatency(LatencyStage stage, chrono::steady_clock::duration duration);
+
+/** @return a text table with the count and the p50, p99, p99.9 and max latencies in microseconds of every stage */
+string formatLatencyStats();
+
+/** starts a thread that writes formatLatencyStats() to fileName every interval and whenever SIGUSR1 is received.
+ * The stats go to stderr if fileName is empty and only SIGUSR1 triggers a dump if interval is 0.
+ * Has to be called before any other threads are started, as SIGUSR1 is blocked to be received with sigwait.
+ */
+void startLatencyStatsExport(string fileName, chrono::seconds interval);
+
+/** records the time from construction to destruction */
+class LatencyTimer final
+{
+    LatencyTimer(const LatencyTimer &) = delete;
+    const LatencyTimer & operator =(const LatencyTimer &) = delete;
+private:
+    const LatencyStage stage;
+    const chrono::steady_clock::time_point startTime;
+public:
+    explicit LatencyTimer(LatencyStage stage)
+        : stage(stage), startTime(chrono::steady_clock::now())
+    {
+    }
+    ~LatencyTimer()
+    {
+        recordLatency(stage, chrono::steady_clock::now() - startTime);
+    }
+};
+
+#endif // LATENCYSTATS_H_INCLUDED
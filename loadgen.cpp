@@ -0,0 +1,269 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "network.h"
+#include "blockcrypt.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+
+using namespace std;
+
+/* pc-loadgen : simulates people counters syncing with the server.
+ * Requests are due at times given by the arrival pattern and handed to a fixed number of connection threads.
+ * Latency is measured from when a request was due, so queueing behind a slow server is included.
+ */
+
+namespace
+{
+enum class ArrivalPattern
+{
+    Steady, // rate requests per second, evenly spaced
+    Storm, // every device at once, every storm period
+    SlowLoris // like steady, but every request is sent a few bytes at a time
+};
+
+struct Options
+{
+    string host = "localhost";
+    uint16_t port = 12347;
+    char requestType = '0';
+    string keyFileName = "enc-key.txt";
+    size_t deviceCount = 1000;
+    size_t eventCount = 10;
+    size_t connectionCount = 64;
+    double duration = 10;
+    double rate = 100;
+    ArrivalPattern pattern = ArrivalPattern::Steady;
+    double stormPeriod = 5;
+    size_t slowChunkSize = 16;
+    chrono::milliseconds slowDelay = chrono::milliseconds(100);
+};
+
+Options options;
+BigUnsigned encryptionModulus = 0_bu;
+BigUnsigned encryptionExponent = 0_bu;
+chrono::steady_clock::time_point startTime;
+atomic<uint64_t> nextRequestIndex(0);
+mutex resultsLock;
+vector<double> latencies; // milliseconds, of acknowledged requests
+uint64_t failedCount = 0;
+
+/** @return when request number index is due, relative to startTime, in seconds */
+double getDueTime(uint64_t index)
+{
+    if(options.pattern == ArrivalPattern::Storm)
+        return (double)(index / options.deviceCount) * options.stormPeriod;
+    return (double)index / options.rate;
+}
+
+string makeRequest(uint64_t index)
+{
+    char buffer[64];
+    size_t device = (size_t)(index % options.deviceCount);
+    string plainText = "loadgen-" + to_string(device) + "\n";
+    snprintf(buffer, sizeof(buffer), "request %llu\n", (unsigned long long)index);
+    plainText += buffer;
+    time_t now = time(NULL);
+    for(size_t i = 0; i < options.eventCount; i++)
+    {
+        snprintf(buffer, sizeof(buffer), "%llx %s\n", (unsigned long long)(now - (time_t)(options.eventCount - i)), (i % 2 == 0 ? "enter" : "exit"));
+        plainText += buffer;
+    }
+    if(options.requestType == '0')
+        return "0" + plainText;
+    string retval(1, options.requestType);
+    if(options.requestType == '4')
+    {
+        uint32_t keyId = getKeyId(encryptionModulus);
+        for(int shift = 24; shift >= 0; shift -= 8)
+            retval += (char)(uint8_t)(keyId >> shift);
+    }
+    size_t blockSize = getBlockPlainTextSize(encryptionModulus);
+    for(size_t i = 0; i < plainText.size(); i += blockSize)
+        retval += encryptBlock(plainText.substr(i, blockSize), encryptionExponent, encryptionModulus).toBase64() + "\n";
+    return retval;
+}
+
+/** @return if the server acknowledged the request */
+bool sendRequest(const string & request)
+{
+    NetworkConnection connection(options.host, options.port);
+    shared_ptr<Writer> writer = connection.pwriter();
+    size_t chunkSize = (options.pattern == ArrivalPattern::SlowLoris ? max<size_t>(options.slowChunkSize, 1) : request.size());
+    for(size_t i = 0; i < request.size(); i++)
+    {
+        if(i > 0 && i % chunkSize == 0)
+        {
+            writer->flush();
+            this_thread::sleep_for(options.slowDelay);
+        }
+        writer->writeByte(request[i]);
+    }
+    connection.shutdownWriting();
+    shared_ptr<Reader> reader = connection.preader();
+    try
+    {
+        return reader->readByte() == '1';
+    }
+    catch(EOFException & e)
+    {
+        return false;
+    }
+}
+
+void connectionThreadFn()
+{
+    vector<double> threadLatencies;
+    uint64_t threadFailedCount = 0;
+    for(;;)
+    {
+        uint64_t index = nextRequestIndex++;
+        double dueTime = getDueTime(index);
+        if(dueTime >= options.duration)
+            break;
+        chrono::steady_clock::time_point due = startTime + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(dueTime));
+        this_thread::sleep_until(due);
+        bool acknowledged = false;
+        try
+        {
+            acknowledged = sendRequest(makeRequest(index));
+        }
+        catch(exception & e)
+        {
+            acknowledged = false;
+        }
+        if(acknowledged)
+            threadLatencies.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - due).count());
+        else
+            threadFailedCount++;
+    }
+    lock_guard<mutex> lockIt(resultsLock);
+    latencies.insert(latencies.end(), threadLatencies.begin(), threadLatencies.end());
+    failedCount += threadFailedCount;
+}
+
+double getPercentile(const vector<double> & sortedValues, double fraction)
+{
+    if(sortedValues.empty())
+        return 0;
+    size_t index = (size_t)(fraction * sortedValues.size());
+    return sortedValues[min(index, sortedValues.size() - 1)];
+}
+
+void usage(const char * programName)
+{
+    cerr << "usage : " << programName << " [--host <host>] [--port <port>] [--type 0|1|4] [--key <public key file>]"
+            " [--devices <count>] [--events <count>] [--connections <count>] [--duration <seconds>]"
+            " [--pattern steady|storm|slow-loris] [--rate <requests per second>] [--storm-period <seconds>]"
+            " [--slow-chunk <bytes>] [--slow-delay-ms <ms>]\n";
+}
+}
+
+int main(int argc, char ** argv)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if(arg == "--host" && i + 1 < argc)
+            options.host = argv[++i];
+        else if(arg == "--port" && i + 1 < argc)
+            options.port = atol(argv[++i]);
+        else if(arg == "--type" && i + 1 < argc && (string(argv[i + 1]) == "0" || string(argv[i + 1]) == "1" || string(argv[i + 1]) == "4"))
+            options.requestType = argv[++i][0];
+        else if(arg == "--key" && i + 1 < argc)
+            options.keyFileName = argv[++i];
+        else if(arg == "--devices" && i + 1 < argc)
+            options.deviceCount = max(atol(argv[++i]), 1L);
+        else if(arg == "--events" && i + 1 < argc)
+            options.eventCount = max(atol(argv[++i]), 0L);
+        else if(arg == "--connections" && i + 1 < argc)
+            options.connectionCount = max(atol(argv[++i]), 1L);
+        else if(arg == "--duration" && i + 1 < argc)
+            options.duration = atof(argv[++i]);
+        else if(arg == "--rate" && i + 1 < argc)
+            options.rate = max(atof(argv[++i]), 0.001);
+        else if(arg == "--storm-period" && i + 1 < argc)
+            options.stormPeriod = max(atof(argv[++i]), 0.001);
+        else if(arg == "--slow-chunk" && i + 1 < argc)
+            options.slowChunkSize = max(atol(argv[++i]), 1L);
+        else if(arg == "--slow-delay-ms" && i + 1 < argc)
+            options.slowDelay = chrono::milliseconds(max(atol(argv[++i]), 0L));
+        else if(arg == "--pattern" && i + 1 < argc)
+        {
+            string pattern = argv[++i];
+            if(pattern == "steady")
+                options.pattern = ArrivalPattern::Steady;
+            else if(pattern == "storm")
+                options.pattern = ArrivalPattern::Storm;
+            else if(pattern == "slow-loris")
+                options.pattern = ArrivalPattern::SlowLoris;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(options.requestType != '0')
+    {
+        ifstream is(options.keyFileName.c_str());
+        string modulus, exponent;
+        if(!(is >> modulus >> exponent))
+        {
+            cerr << "Error : can't load key from " << options.keyFileName << endl;
+            return 1;
+        }
+        try
+        {
+            encryptionExponent = BigUnsigned::parseHexByteString(exponent);
+            encryptionModulus = BigUnsigned::parseHexByteString(modulus);
+            if(getBlockPlainTextSize(encryptionModulus) == 0)
+                throw runtime_error("key too small");
+        }
+        catch(exception & e)
+        {
+            cerr << "Error : can't load key from " << options.keyFileName << " : " << e.what() << endl;
+            return 1;
+        }
+    }
+    startTime = chrono::steady_clock::now();
+    vector<thread> threads;
+    for(size_t i = 0; i < options.connectionCount; i++)
+        threads.push_back(thread(connectionThreadFn));
+    for(thread & t : threads)
+        t.join();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    sort(latencies.begin(), latencies.end());
+    printf("requests : %llu acknowledged, %llu failed\n", (unsigned long long)latencies.size(), (unsigned long long)failedCount);
+    printf("achieved : %.1f requests/s over %.2f s\n", latencies.size() / elapsed, elapsed);
+    printf("latency ms : p50 %.2f p90 %.2f p99 %.2f p99.9 %.2f max %.2f\n", getPercentile(latencies, 0.5), getPercentile(latencies, 0.9),
+           getPercentile(latencies, 0.99), getPercentile(latencies, 0.999), latencies.empty() ? 0.0 : latencies.back());
+    return 0;
+}
@@ -0,0 +1,313 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "logwriter.h"
+#include "latencystats.h"
+#include "trace.h"
+#include <algorithm>
+#include <vector>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+using namespace std;
+
+namespace
+{
+string getDirectory(const string & fileName)
+{
+    size_t slash = fileName.find_last_of('/');
+    if(slash == string::npos)
+        return ".";
+    if(slash == 0)
+        return "/";
+    return fileName.substr(0, slash);
+}
+
+string getBaseName(const string & fileName)
+{
+    size_t slash = fileName.find_last_of('/');
+    if(slash == string::npos)
+        return fileName;
+    return fileName.substr(slash + 1);
+}
+
+bool endsWith(const string & str, const string & suffix)
+{
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/** rotated files sort by time, with ".gz" ignored so compressed and uncompressed files interleave correctly */
+string getSortKey(const string & fileName)
+{
+    if(endsWith(fileName, ".gz"))
+        return fileName.substr(0, fileName.size() - 3);
+    return fileName;
+}
+}
+
+LogWriter::LogWriter(string fileName, chrono::milliseconds flushInterval, size_t flushSize, bool useDataSync, LogRotation rotation)
+    : head(nullptr), pendingSize(0), fileName(fileName), rotation(rotation), flushInterval(flushInterval), flushSize(flushSize), useDataSync(useDataSync), done(false)
+{
+    fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd == -1)
+        throw IOException(string("IO Error : can't open ") + fileName + " : " + strerror(errno));
+    struct stat st;
+    fileSize = (fstat(fd, &st) == 0 ? st.st_size : 0);
+    fileOpenTime = chrono::steady_clock::now();
+    writerThread = thread(&LogWriter::writerFn, this);
+}
+
+LogWriter::~LogWriter()
+{
+    sleepLock.lock();
+    done = true;
+    sleepCond.notify_all();
+    sleepLock.unlock();
+    writerThread.join();
+    if(maintenanceThread.joinable())
+        maintenanceThread.join();
+    close(fd);
+}
+
+void LogWriter::write(string text)
+{
+    if(text.empty())
+        return;
+    size_t size = text.size();
+    Record * record = new Record(move(text));
+    record->next = head.load(memory_order_relaxed);
+    while(!head.compare_exchange_weak(record->next, record, memory_order_release, memory_order_relaxed))
+    {
+    }
+    // the writer thread wakes up by itself after flushInterval, so only notify when a write is due now.
+    // sleepLock is taken first so the notify can't land between the writer checking isWriteDue and waiting
+    if(pendingSize.fetch_add(size, memory_order_relaxed) + size >= flushSize || flushInterval.count() == 0)
+    {
+        sleepLock.lock();
+        sleepLock.unlock();
+        sleepCond.notify_one();
+    }
+}
+
+void LogWriter::writeRecords(string & buffer)
+{
+    Record * records = head.exchange(nullptr, memory_order_acquire);
+    Record * reversed = nullptr;
+    while(records != nullptr)
+    {
+        Record * next = records->next;
+        records->next = reversed;
+        reversed = records;
+        records = next;
+    }
+    size_t size = 0;
+    while(reversed != nullptr)
+    {
+        Record * next = reversed->next;
+        buffer += reversed->text;
+        size += reversed->text.size();
+        delete reversed;
+        reversed = next;
+    }
+    pendingSize.fetch_sub(size, memory_order_relaxed);
+    if(buffer.empty())
+        return;
+    if(isRotationDue(buffer.size()))
+        rotate();
+    LatencyTimer timer(LatencyStage::LogFlush);
+    TRACE_SCOPE("log-flush");
+    const char * pbuffer = buffer.data();
+    size_t sizeLeft = buffer.size();
+    while(sizeLeft > 0)
+    {
+        ssize_t retval = ::write(fd, pbuffer, sizeLeft);
+        if(retval == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            cerr << "Error : can't write to log : " << strerror(errno) << endl;
+            break;
+        }
+        sizeLeft -= retval;
+        pbuffer += retval;
+        fileSize += retval;
+    }
+    if(useDataSync)
+        fdatasync(fd);
+    buffer.clear();
+}
+
+bool LogWriter::isRotationDue(size_t writeSize) const
+{
+    if(fileSize == 0)
+        return false;
+    if(rotation.maxSize > 0 && fileSize + writeSize > rotation.maxSize)
+        return true;
+    if(rotation.maxAge.count() > 0 && chrono::steady_clock::now() - fileOpenTime >= rotation.maxAge)
+        return true;
+    return false;
+}
+
+void LogWriter::rotate()
+{
+    time_t now = time(nullptr);
+    struct tm tmv;
+    gmtime_r(&now, &tmv);
+    char timeStr[32];
+    strftime(timeStr, sizeof(timeStr), "%Y%m%d-%H%M%S", &tmv);
+    string rotatedName = fileName + "." + timeStr;
+    for(int i = 1; access(rotatedName.c_str(), F_OK) == 0 || access((rotatedName + ".gz").c_str(), F_OK) == 0; i++)
+        rotatedName = fileName + "." + timeStr + "-" + to_string(i);
+    // give the current file its final name first so it stays reachable, then replace the log name
+    if(link(fileName.c_str(), rotatedName.c_str()) == -1)
+    {
+        cerr << "Error : can't rotate log to " << rotatedName << " : " << strerror(errno) << endl;
+        fileOpenTime = chrono::steady_clock::now(); // don't retry on every write
+        return;
+    }
+    string tempName = fileName + ".new";
+    int newFd = open(tempName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if(newFd == -1 || rename(tempName.c_str(), fileName.c_str()) == -1)
+    {
+        cerr << "Error : can't create new log file : " << strerror(errno) << endl;
+        if(newFd != -1)
+        {
+            close(newFd);
+            unlink(tempName.c_str());
+        }
+        unlink(rotatedName.c_str());
+        fileOpenTime = chrono::steady_clock::now();
+        return;
+    }
+    if(useDataSync)
+        fdatasync(fd);
+    close(fd);
+    fd = newFd;
+    fileSize = 0;
+    fileOpenTime = chrono::steady_clock::now();
+    if(!rotation.compress && rotation.keepCount == 0 && rotation.keepAge.count() == 0)
+        return;
+    if(maintenanceThread.joinable())
+        maintenanceThread.join();
+    maintenanceThread = thread([this, rotatedName]()
+    {
+        if(rotation.compress)
+            compressFile(rotatedName);
+        removeOldFiles();
+    });
+}
+
+void LogWriter::compressFile(string fileName)
+{
+    string tempName = fileName + ".gz.tmp";
+    int inFd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if(inFd == -1)
+    {
+        cerr << "Error : can't open " << fileName << " : " << strerror(errno) << endl;
+        return;
+    }
+    gzFile out = gzopen(tempName.c_str(), "wb");
+    bool good = (out != nullptr);
+    char buffer[1 << 16];
+    while(good)
+    {
+        ssize_t retval = read(inFd, buffer, sizeof(buffer));
+        if(retval == -1 && errno == EINTR)
+            continue;
+        if(retval <= 0)
+        {
+            good = (retval == 0);
+            break;
+        }
+        good = (gzwrite(out, buffer, retval) == retval);
+    }
+    close(inFd);
+    if(out != nullptr && gzclose(out) != Z_OK)
+        good = false;
+    if(!good || rename(tempName.c_str(), (fileName + ".gz").c_str()) == -1)
+    {
+        cerr << "Error : can't compress " << fileName << endl;
+        unlink(tempName.c_str());
+        return;
+    }
+    unlink(fileName.c_str());
+}
+
+void LogWriter::removeOldFiles() const
+{
+    if(rotation.keepCount == 0 && rotation.keepAge.count() == 0)
+        return;
+    string directory = getDirectory(fileName);
+    string prefix = getBaseName(fileName) + ".";
+    vector<string> files;
+    DIR * dir = opendir(directory.c_str());
+    if(dir == nullptr)
+        return;
+    while(dirent * entry = readdir(dir))
+    {
+        string name = entry->d_name;
+        if(name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        if(name == prefix + "new" || endsWith(name, ".tmp"))
+            continue;
+        files.push_back(name);
+    }
+    closedir(dir);
+    sort(files.begin(), files.end(), [](const string & a, const string & b)
+    {
+        return getSortKey(a) > getSortKey(b);
+    });
+    time_t now = time(nullptr);
+    for(size_t i = 0; i < files.size(); i++)
+    {
+        string path = directory + "/" + files[i];
+        bool remove = (rotation.keepCount > 0 && i >= rotation.keepCount);
+        struct stat st;
+        if(!remove && rotation.keepAge.count() > 0 && stat(path.c_str(), &st) == 0)
+            remove = (now - st.st_mtime >= rotation.keepAge.count());
+        if(remove && unlink(path.c_str()) == -1)
+            cerr << "Error : can't remove old log " << path << " : " << strerror(errno) << endl;
+    }
+}
+
+void LogWriter::writerFn()
+{
+    string buffer;
+    for(;;)
+    {
+        {
+            unique_lock<mutex> lockIt(sleepLock);
+            auto isWriteDue = [this]()
+            {
+                return done || (head.load(memory_order_relaxed) != nullptr && (pendingSize >= flushSize || flushInterval.count() == 0));
+            };
+            if(flushInterval.count() == 0)
+                sleepCond.wait(lockIt, isWriteDue);
+            else
+                sleepCond.wait_for(lockIt, flushInterval, isWriteDue);
+        }
+        bool isDone = done;
+        writeRecords(buffer);
+        if(isDone && head.load() == nullptr)
+            return;
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef LOGWRITER_H_INCLUDED
+#define LOGWRITER_H_INCLUDED
+
+#include "stream.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+using namespace std;
+
+/** when the log file is rotated and how long closed files are kept, 0 disables each limit */
+struct LogRotation
+{
+    size_t maxSize = 0;
+    chrono::seconds maxAge = chrono::seconds(0);
+    size_t keepCount = 0;
+    chrono::seconds keepAge = chrono::seconds(0);
+    bool compress = false;
+};
+
+/** appends records to a log file from a dedicated thread.
+ * Records are passed through a lock-free queue and coalesced into large writes,
+ * each record is written contiguously.
+ * The writer thread also rotates the file : the new file is created under a temporary name and renamed
+ * over the old one, so the log name always refers to a complete file and ingestion never waits.
+ * Compression and deletion of closed files are done on a separate maintenance thread.
+ */
+class LogWriter final
+{
+    LogWriter(const LogWriter &) = delete;
+    const LogWriter & operator =(const LogWriter &) = delete;
+private:
+    struct Record
+    {
+        Record * next;
+        string text;
+        explicit Record(string text)
+            : next(nullptr), text(move(text))
+        {
+        }
+    };
+    atomic<Record *> head; // records in reverse order
+    atomic_size_t pendingSize;
+    const string fileName;
+    int fd;
+    size_t fileSize;
+    chrono::steady_clock::time_point fileOpenTime;
+    const LogRotation rotation;
+    thread maintenanceThread;
+    const chrono::milliseconds flushInterval;
+    const size_t flushSize;
+    const bool useDataSync;
+    mutex sleepLock;
+    condition_variable sleepCond;
+    atomic_bool done;
+    thread writerThread;
+    void writerFn();
+    void writeRecords(string & buffer);
+    bool isRotationDue(size_t writeSize) const;
+    void rotate();
+    static void compressFile(string fileName);
+    void removeOldFiles() const;
+public:
+    /** @param flushInterval how long records are collected before writing them, 0 to write as soon as possible
+     * @param flushSize number of pending bytes that causes a write before the flush interval ends
+     * @param useDataSync if fdatasync is called after every write
+     * @param rotation when to rotate the log file, closed files are named <fileName>.<UTC time>
+     */
+    LogWriter(string fileName, chrono::milliseconds flushInterval, size_t flushSize, bool useDataSync, LogRotation rotation = LogRotation());
+    ~LogWriter();
+    void write(string text);
+};
+
+#endif // LOGWRITER_H_INCLUDED
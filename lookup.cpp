@@ -0,0 +1,85 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "eventpartition.h"
+#include "rollups.h"
+#include <iostream>
+#include <cstdlib>
+#include <climits>
+
+using namespace std;
+
+int main(int argc, char ** argv)
+{
+    if(argc >= 2 && string(argv[1]) == "--rollups")
+    {
+        if(argc != 5 && argc != 7)
+        {
+            cerr << "usage : " << argv[0] << " --rollups <rollup file> <device name> <bucket seconds> [<start time> <end time>]\n";
+            return 1;
+        }
+        time_t startTime = 0, endTime = time(NULL);
+        if(argc == 7)
+        {
+            startTime = atoll(argv[5]);
+            endTime = atoll(argv[6]);
+        }
+        try
+        {
+            size_t granularityIndex = EventRollups::getGranularityIndex(atoll(argv[4]));
+            if(granularityIndex == EventRollups::GranularityCount)
+                throw runtime_error("bucket seconds must be 300, 3600 or 86400");
+            EventRollups rollups(argv[2], chrono::seconds(0), true);
+            rollups.query(argv[3], granularityIndex, startTime, endTime, [](time_t bucketStart, uint64_t count)
+            {
+                cout << bucketStart << " " << count << "\n";
+            });
+        }
+        catch(exception & e)
+        {
+            cerr << "Error : " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if(argc != 3 && argc != 5)
+    {
+        cerr << "usage : " << argv[0] << " <partition directory> <device name> [<start time> <end time>]\n";
+        cerr << "        " << argv[0] << " --rollups <rollup file> <device name> <bucket seconds> [<start time> <end time>]\n";
+        return 1;
+    }
+    time_t startTime = LLONG_MIN, endTime = LLONG_MAX;
+    if(argc == 5)
+    {
+        startTime = atoll(argv[3]);
+        endTime = atoll(argv[4]);
+    }
+    string deviceName = argv[2];
+    try
+    {
+        EventPartitionFile::queryDirectory(argv[1], deviceName, startTime, endTime, [&deviceName](const Event & event)
+        {
+            cout << "Event : " << deviceName << " : " << event.deviceTime << " : " << event.text << "\n";
+        });
+    }
+    catch(exception & e)
+    {
+        cerr << "Error : " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
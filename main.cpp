@@ -1,174 +1,441 @@
 #include <iostream>
 #include <fstream>
-#include <sstream>
-#include <ctime>
 #include "bigmath.h"
+#include "handler.h"
 #include "stream.h"
 #include "network.h"
+#include "logwriter.h"
+#include "eventstore.h"
+#include "eventpartition.h"
+#include "rollups.h"
+#include "eventcolumns.h"
+#include "eventseries.h"
+#include "queryserver.h"
+#include "latencystats.h"
+#include "trace.h"
+#include "scheduler.h"
+#include "memorybudget.h"
 #include <vector>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
+#include <signal.h>
 
 using namespace std;
 
-BigUnsigned decryptionModulus = 0_bu;
-BigUnsigned decryptionExponent = 0_bu;
-const size_t randomBitCount = 64;
-const WordType checkSumModulus = 8191;
-bool useInfoMessages = false;
+vector<shared_ptr<EventSink>> eventSinks;
 
-void connectionHandler(ReaderIStream & is, WriterOStream & os, string & messages)
+/** writes the log lines of a request so far and forgets them */
+void writeMessages(LogWriter * plogWriter, string & messages)
 {
-    string msg;
-    char ch;
-    while(is.get(ch))
-        msg += ch;
-    is.close();
-    //messages += "msg : \"" + msg + "\"\n";
-    if(msg.size() < 1)
+    if(plogWriter && !messages.empty())
     {
-        messages += "Error : Invalid request\n";
-        os << "0";
-        return;
+        LatencyTimer logTimer(LatencyStage::Log);
+        TRACE_SCOPE("log");
+        plogWriter->write(messages);
     }
-    switch(msg[0])
+    messages.clear();
+}
+
+/** handles a request on a scheduler thread, writing its events and log lines a batch at a time as they are parsed
+ * @param reader the request, received already
+ * @param acceptTime when the connection was accepted, for the request latency
+ */
+void connectionThreadFn(shared_ptr<Reader> reader, shared_ptr<Writer> writer, const string & sourceAddress, LogWriter * plogWriter,
+                        uint64_t traceId, chrono::steady_clock::time_point acceptTime, chrono::steady_clock::time_point submitTime)
+{
+    TRACE_SET_ID(traceId);
+    recordLatency(LatencyStage::Queue, chrono::steady_clock::now() - submitTime);
+    TRACE_SPAN("queue", submitTime);
+    ReaderIStream is(reader);
+    WriterOStream os(writer);
+    writer = nullptr; // remove reference
+    static thread_local string messages; // reused to avoid allocating for every connection
+    messages.clear();
+    connectionHandler(is, os, sourceAddress, messages, [plogWriter](const string & deviceName, vector<Event> & events, string & messages)
     {
-    case '0': // unencrypted
-        msg = msg.substr(1);
-        if(decryptionModulus != 0_bu)
         {
-            messages += "Error : unencrypted message attempted\n";
-            os << "0";
-            return;
+            LatencyTimer sinksTimer(LatencyStage::Sinks);
+            TRACE_SCOPE("sinks");
+            for(shared_ptr<EventSink> sink : eventSinks)
+            {
+                try
+                {
+                    sink->writeEvents(deviceName, events);
+                }
+                catch(exception & e)
+                {
+                    messages += string("Error : ") + e.what() + "\n";
+                }
+            }
         }
-        break;
-    case '1': // encrypted
+        writeMessages(plogWriter, messages);
+    });
+    writeMessages(plogWriter, messages);
+    recordLatency(LatencyStage::Request, chrono::steady_clock::now() - acceptTime);
+    TRACE_SPAN("request", acceptTime);
+}
+
+/** receives a whole request on a receive pool thread, so the scheduler threads never wait for a client,
+ * then schedules it by the cost estimated from its head and size.
+ * The request is buffered in memory as far as requestMemoryBudget allows and in a spill file past that.
+ * @param receiveTimeout how long receiving the request may take in all, 0 for no limit
+ */
+void receiveThreadFn(shared_ptr<NetworkConnection> connection, const string & sourceAddress, LogWriter * plogWriter, RequestScheduler & scheduler,
+                     size_t maxRequestSize, uint64_t traceId, chrono::steady_clock::time_point acceptTime, chrono::steady_clock::duration receiveTimeout)
+{
+    TRACE_SET_ID(traceId);
+    LimitedReader reader(connection->preader(), maxRequestSize);
+    shared_ptr<Writer> writer = connection->pwriter();
+    string head;
+    shared_ptr<SpillBuffer> request = make_shared<SpillBuffer>(requestMemoryBudget, requestSpillSize, spillDirectory);
+    try
     {
-        msg = msg.substr(1);
-        string unencrypted;
+        LatencyTimer timer(LatencyStage::Receive);
+        TRACE_SCOPE("receive");
+        if(receiveTimeout.count() > 0)
+            connection->setReceiveDeadline(chrono::steady_clock::now() + receiveTimeout);
+        readRequestHead(reader, head);
+        request->append(head.data(), head.size());
         try
         {
-            size_t newLineIndex = msg.find_first_of('\n');
-            size_t location = 0;
-            while(newLineIndex != string::npos)
-            {
-                BigUnsigned v = BigUnsigned::parseBase64(msg.substr(location, newLineIndex - location));
-                location = newLineIndex + 1;
-                v = powMod(v, decryptionExponent, decryptionModulus);
-                BigUnsigned checkSum;
-                BigUnsigned::divMod(v, checkSumModulus, v, checkSum);
-                //messages += "checksum : " + checkSum.toString(0x10) + "\n";
-                //messages += "message : " + v.toString(0x10) + "\n";
-                if(checkSum != v % checkSumModulus)
-                    throw runtime_error("checksum doesn't match");
-                v >>= randomBitCount;
-                unencrypted += v.toByteString();
-                newLineIndex = msg.find_first_of('\n', location);
-            }
+            for(;;)
+                request->append((char)reader.readByte());
         }
-        catch(exception & e)
+        catch(EOFException & e)
         {
-            messages += string("Error : ") + e.what() + "\n";
-            os << "0";
-            return;
         }
-        msg = unencrypted;
-        break;
-    }
-    default:
-        messages += "Error : Invalid encryption type\n";
-        os << "0";
-        return;
     }
-    size_t deviceNameLength = msg.find_first_of('\n');
-    if(deviceNameLength == string::npos)
+    catch(IOException & e)
     {
-        messages += "Error : can't find device name\n";
-        os << "0";
+        // refused without reading the rest, so the peer may see the connection reset instead of the response
+        try
+        {
+            writer->writeByte((uint8_t)'0');
+            writer->flush();
+        }
+        catch(IOException & e)
+        {
+        }
+        if(plogWriter)
+            plogWriter->write("Error : " + sourceAddress + " : " + e.what() + "\n");
         return;
     }
-    string deviceName = msg.substr(0, deviceNameLength);
-    msg = msg.substr(deviceNameLength + 1);
-    if(useInfoMessages)
-        messages += "Info : " + deviceName + " : syncing\n";
-    os << "1";
-    os.close();
-    size_t statsStringLength = msg.find_first_of('\n');
-    string statsString = "";
-    if(statsStringLength != string::npos)
+    size_t cost = estimateRequestCost(head, request->size() - head.size());
+    connection = nullptr; // the writer keeps the socket open
+    shared_ptr<Reader> requestReader = request->preader();
+    chrono::steady_clock::time_point submitTime = chrono::steady_clock::now();
+    string sourceAddressCopy = sourceAddress;
+    // request holds the buffer the reader reads from, and its memory, until the request has been handled
+    scheduler.submit(cost, [request, requestReader, writer, sourceAddressCopy, plogWriter, traceId, acceptTime, submitTime]()
     {
-        statsString = msg.substr(0, statsStringLength);
-        msg = msg.substr(statsStringLength + 1);
-    }
-    string sentTime = statsString;
-    vector<pair<time_t, string>> parts;
-    while(msg != "")
+        connectionThreadFn(requestReader, writer, sourceAddressCopy, plogWriter, traceId, acceptTime, submitTime);
+    });
+}
+
+int main(int argc, char ** argv)
+{
+    long logFlushInterval = 100, logFlushSize = 1 << 20;
+    bool useLogDataSync = false, useTextLog = true;
+    LogRotation logRotation;
+    string eventStoreDirectory;
+    long segmentSize = 64 << 20;
+    string partitionDirectory;
+    long partitionDuration = 3600, indexInterval = 64;
+    string rollupFileName;
+    long rollupFlushInterval = 60;
+    string columnarDirectory;
+    long columnarBlockRowCount = 65536, columnarBlocksPerFile = 16, columnarBlockDuration = 300;
+    string seriesDirectory;
+    long seriesBlockRowCount = 4096, seriesBlockDuration = 60, seriesSegmentSize = 64 << 20;
+    string deviceRegistryFileName;
+    long deviceRegistryFlushInterval = 60;
+    const string keyFileName = "dec-key.txt";
+    long keyWatchInterval = 0;
+    string statsFileName;
+    string traceFileName = "people-counter-trace.json";
+    long traceRingSize = 0;
+    long statsInterval = 0;
+    long dedupWindow = -1, dedupRecentCount = 4096;
+    double sourceRate = 0, sourceBurst = 10, deviceRate = 0, deviceBurst = 5;
+    long rateLimitKeyCount = 1 << 16;
+    long handlerThreadCount = 4, schedulerAgingInterval = 250;
+    vector<size_t> requestLaneCostLimits = {0, 4, 32};
+    long maxRequestSize = 16 << 20, maxInFlightSize = 256 << 20;
+    long receiveTimeout = 30, receiveThreadCount = 16, maxReceivingConnectionCount = 1024;
+    long queryPort = 0, queryTimeout = 60, maxQueryConnectionCount = 64, indexBucketSeconds = 60, indexRetentionHours = 7 * 24, recentEventCount = 100;
+    for(int i = 1; i < argc; i++)
     {
-        size_t newLinePos = msg.find_first_of('\n');
-        if(newLinePos == string::npos)
+        string arg = argv[i];
+        if(arg == "--info")
+            useInfoMessages = true;
+        else if(arg == "--epoch-times")
+            useEpochTimes = true;
+        else if(arg == "--log-flush-ms" && i + 1 < argc)
+            logFlushInterval = atol(argv[++i]);
+        else if(arg == "--log-flush-bytes" && i + 1 < argc)
+            logFlushSize = atol(argv[++i]);
+        else if(arg == "--log-sync")
+            useLogDataSync = true;
+        else if(arg == "--no-text-log")
+            useTextLog = false;
+        else if(arg == "--log-rotate-bytes" && i + 1 < argc)
+            logRotation.maxSize = max(atol(argv[++i]), 0L);
+        else if(arg == "--log-rotate-seconds" && i + 1 < argc)
+            logRotation.maxAge = chrono::seconds(max(atol(argv[++i]), 0L));
+        else if(arg == "--log-keep-files" && i + 1 < argc)
+            logRotation.keepCount = max(atol(argv[++i]), 0L);
+        else if(arg == "--log-keep-hours" && i + 1 < argc)
+            logRotation.keepAge = chrono::hours(max(atol(argv[++i]), 0L));
+        else if(arg == "--log-compress")
+            logRotation.compress = true;
+        else if(arg == "--event-store" && i + 1 < argc)
+            eventStoreDirectory = argv[++i];
+        else if(arg == "--segment-size" && i + 1 < argc)
+            segmentSize = atol(argv[++i]);
+        else if(arg == "--partition-dir" && i + 1 < argc)
+            partitionDirectory = argv[++i];
+        else if(arg == "--partition-seconds" && i + 1 < argc)
+            partitionDuration = atol(argv[++i]);
+        else if(arg == "--index-interval" && i + 1 < argc)
+            indexInterval = atol(argv[++i]);
+        else if(arg == "--rollup-file" && i + 1 < argc)
+            rollupFileName = argv[++i];
+        else if(arg == "--rollup-flush-seconds" && i + 1 < argc)
+            rollupFlushInterval = atol(argv[++i]);
+        else if(arg == "--columnar-dir" && i + 1 < argc)
+            columnarDirectory = argv[++i];
+        else if(arg == "--columnar-block-rows" && i + 1 < argc)
+            columnarBlockRowCount = atol(argv[++i]);
+        else if(arg == "--columnar-file-blocks" && i + 1 < argc)
+            columnarBlocksPerFile = atol(argv[++i]);
+        else if(arg == "--columnar-block-seconds" && i + 1 < argc)
+            columnarBlockDuration = atol(argv[++i]);
+        else if(arg == "--series-dir" && i + 1 < argc)
+            seriesDirectory = argv[++i];
+        else if(arg == "--series-block-rows" && i + 1 < argc)
+            seriesBlockRowCount = atol(argv[++i]);
+        else if(arg == "--series-block-seconds" && i + 1 < argc)
+            seriesBlockDuration = atol(argv[++i]);
+        else if(arg == "--series-segment-size" && i + 1 < argc)
+            seriesSegmentSize = atol(argv[++i]);
+        else if(arg == "--device-registry" && i + 1 < argc)
+            deviceRegistryFileName = argv[++i];
+        else if(arg == "--device-registry-flush-seconds" && i + 1 < argc)
+            deviceRegistryFlushInterval = atol(argv[++i]);
+        else if(arg == "--key-watch-seconds" && i + 1 < argc)
+            keyWatchInterval = atol(argv[++i]);
+        else if(arg == "--stats-file" && i + 1 < argc)
+            statsFileName = argv[++i];
+        else if(arg == "--stats-seconds" && i + 1 < argc)
+            statsInterval = atol(argv[++i]);
+        else if(arg == "--trace-file" && i + 1 < argc)
+            traceFileName = argv[++i];
+        else if(arg == "--trace-spans" && i + 1 < argc)
+            traceRingSize = atol(argv[++i]);
+        else if(arg == "--dedup-window" && i + 1 < argc)
+            dedupWindow = atol(argv[++i]);
+        else if(arg == "--dedup-recent-events" && i + 1 < argc)
+            dedupRecentCount = atol(argv[++i]);
+        else if(arg == "--source-rate" && i + 1 < argc)
+            sourceRate = atof(argv[++i]);
+        else if(arg == "--source-burst" && i + 1 < argc)
+            sourceBurst = atof(argv[++i]);
+        else if(arg == "--device-rate" && i + 1 < argc)
+            deviceRate = atof(argv[++i]);
+        else if(arg == "--device-burst" && i + 1 < argc)
+            deviceBurst = atof(argv[++i]);
+        else if(arg == "--rate-limit-entries" && i + 1 < argc)
+            rateLimitKeyCount = atol(argv[++i]);
+        else if(arg == "--handler-threads" && i + 1 < argc)
+            handlerThreadCount = atol(argv[++i]);
+        else if(arg == "--lane-costs" && i + 1 < argc)
+        {
+            requestLaneCostLimits.clear();
+            istringstream is(argv[++i]);
+            string cost;
+            while(getline(is, cost, ','))
+                requestLaneCostLimits.push_back(max(atol(cost.c_str()), 0L));
+            sort(requestLaneCostLimits.begin(), requestLaneCostLimits.end());
+        }
+        else if(arg == "--aging-ms" && i + 1 < argc)
+            schedulerAgingInterval = atol(argv[++i]);
+        else if(arg == "--max-request-bytes" && i + 1 < argc)
+            maxRequestSize = atol(argv[++i]);
+        else if(arg == "--max-in-flight-bytes" && i + 1 < argc)
+            maxInFlightSize = atol(argv[++i]);
+        else if(arg == "--spill-after-bytes" && i + 1 < argc)
+            requestSpillSize = max(atol(argv[++i]), 0L);
+        else if(arg == "--spill-dir" && i + 1 < argc)
+            spillDirectory = argv[++i];
+        else if(arg == "--receive-timeout-seconds" && i + 1 < argc)
+            receiveTimeout = atol(argv[++i]);
+        else if(arg == "--receive-threads" && i + 1 < argc)
+            receiveThreadCount = atol(argv[++i]);
+        else if(arg == "--max-receiving-connections" && i + 1 < argc)
+            maxReceivingConnectionCount = atol(argv[++i]);
+        else if(arg == "--query-port" && i + 1 < argc)
+            queryPort = atol(argv[++i]);
+        else if(arg == "--query-timeout-seconds" && i + 1 < argc)
+            queryTimeout = atol(argv[++i]);
+        else if(arg == "--max-query-connections" && i + 1 < argc)
+            maxQueryConnectionCount = atol(argv[++i]);
+        else if(arg == "--index-bucket-seconds" && i + 1 < argc)
+            indexBucketSeconds = atol(argv[++i]);
+        else if(arg == "--index-retention-hours" && i + 1 < argc)
+            indexRetentionHours = atol(argv[++i]);
+        else if(arg == "--recent-events" && i + 1 < argc)
+            recentEventCount = atol(argv[++i]);
+        else
         {
-            parts.push_back(make_pair((time_t)0, msg));
-            break;
+            cerr << "usage : " << argv[0] << " [--info] [--epoch-times] [--log-flush-ms <ms>] [--log-flush-bytes <bytes>] [--log-sync] [--no-text-log]"
+                    " [--log-rotate-bytes <bytes>] [--log-rotate-seconds <seconds>] [--log-keep-files <count>] [--log-keep-hours <hours>] [--log-compress]"
+                    " [--event-store <directory>] [--segment-size <bytes>]"
+                    " [--partition-dir <directory>] [--partition-seconds <seconds>] [--index-interval <records>]"
+                    " [--rollup-file <file>] [--rollup-flush-seconds <seconds>]"
+                    " [--columnar-dir <directory>] [--columnar-block-rows <rows>] [--columnar-file-blocks <blocks>] [--columnar-block-seconds <seconds>]"
+                    " [--series-dir <directory>] [--series-block-rows <rows>] [--series-block-seconds <seconds>] [--series-segment-size <bytes>]"
+                    " [--key-watch-seconds <seconds>] [--stats-file <file>] [--stats-seconds <seconds>] [--trace-file <file>] [--trace-spans <spans per thread>]"
+                    " [--device-registry <file>] [--device-registry-flush-seconds <seconds>] [--dedup-window <seconds>] [--dedup-recent-events <count>]"
+                    " [--source-rate <requests per minute>] [--source-burst <requests>] [--device-rate <requests per minute>] [--device-burst <requests>] [--rate-limit-entries <count>]"
+                    " [--handler-threads <count>] [--lane-costs <blocks>,...] [--aging-ms <ms>] [--max-request-bytes <bytes>] [--max-in-flight-bytes <bytes>]"
+                    " [--spill-after-bytes <bytes>] [--spill-dir <directory>]"
+                    " [--receive-timeout-seconds <seconds>] [--receive-threads <count>] [--max-receiving-connections <count>]"
+                    " [--query-port <port>] [--query-timeout-seconds <seconds>] [--max-query-connections <count>] [--index-bucket-seconds <seconds>] [--index-retention-hours <hours>] [--recent-events <count>]\n";
+            return 1;
         }
-        parts.push_back(make_pair((time_t)0, msg.substr(0, newLinePos)));
-        msg = msg.substr(newLinePos + 1);
     }
-    for(pair<time_t, string> & part : parts)
+    // SIGTERM and SIGINT are blocked in every thread and handled by waiting for them, so stopping writes what the event sinks buffer
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGTERM);
+    sigaddset(&stopSignals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+    startLatencyStatsExport(statsFileName, chrono::seconds(max(statsInterval, 0L)));
+    setTraceRingSize(max(traceRingSize, 0L));
+    startTraceExport(traceFileName);
+    startKeyRingReloader(keyFileName, chrono::seconds(max(keyWatchInterval, 0L)));
+    unique_ptr<LogWriter> logWriter;
+    unique_ptr<QueryServer> queryServer;
+    try
     {
-        time_t t = time(NULL);
-        string str = get<1>(part);
-        size_t splitPos = str.find_first_of(' ');
-        if(splitPos != string::npos)
+        if(useTextLog)
+            logWriter = unique_ptr<LogWriter>(new LogWriter("/var/www/people-counter-log.txt", chrono::milliseconds(max(logFlushInterval, 0L)), max(logFlushSize, 1L), useLogDataSync, logRotation));
+        deviceRegistry = unique_ptr<DeviceRegistry>(new DeviceRegistry(deviceRegistryFileName, chrono::seconds(max(deviceRegistryFlushInterval, 1L))));
+        if(dedupWindow >= 0)
+            eventDeduplicator = unique_ptr<EventDeduplicator>(new EventDeduplicator(dedupWindow, max(dedupRecentCount, 1L)));
+        if(sourceRate > 0)
+            sourceRateLimiter = unique_ptr<RateLimiter>(new RateLimiter(sourceRate / 60, sourceBurst, max(rateLimitKeyCount, 1L)));
+        if(deviceRate > 0)
+            deviceRateLimiter = unique_ptr<RateLimiter>(new RateLimiter(deviceRate / 60, deviceBurst, max(rateLimitKeyCount, 1L)));
+        if(eventStoreDirectory != "")
+            eventSinks.push_back(make_shared<EventStore>(eventStoreDirectory, max(segmentSize, 1L)));
+        if(partitionDirectory != "")
+            eventSinks.push_back(make_shared<EventPartitionWriter>(partitionDirectory, max(partitionDuration, 1L), max(indexInterval, 1L)));
+        if(rollupFileName != "")
+            eventSinks.push_back(make_shared<EventRollups>(rollupFileName, chrono::seconds(max(rollupFlushInterval, 1L))));
+        if(columnarDirectory != "")
+            eventSinks.push_back(make_shared<EventColumnWriter>(columnarDirectory, max(columnarBlockRowCount, 1L), max(columnarBlocksPerFile, 1L), max(columnarBlockDuration, 1L)));
+        if(seriesDirectory != "")
+            eventSinks.push_back(make_shared<EventSeriesWriter>(seriesDirectory, max(seriesBlockRowCount, 1L), max(seriesBlockDuration, 1L), max(seriesSegmentSize, 1L)));
+        if(queryPort > 0 && queryPort <= 0xFFFF)
         {
-            istringstream is(str.substr(0, splitPos));
-            is >> hex >> t;
-            str = str.substr(splitPos + 1);
+            shared_ptr<EventIndex> index = make_shared<EventIndex>(indexBucketSeconds, indexRetentionHours * 60 * 60, max(recentEventCount, 0L));
+            eventSinks.push_back(index);
+            queryServer = unique_ptr<QueryServer>(new QueryServer(queryPort, index, chrono::seconds(max(queryTimeout, 0L)), max(maxQueryConnectionCount, 1L)));
         }
-        part = make_pair(t, str);
     }
-    for(pair<time_t, string> part : parts)
+    catch(exception & e)
     {
-        char str[256];
-        strftime(str, sizeof(str), "%c", localtime(&get<0>(part)));
-        messages += "Event : " + deviceName + " : " + str + " : " + get<1>(part) + "\n";
+        cerr << "Error : " << e.what() << endl;
+        return 1;
     }
-}
-
-void connectionThreadFn(shared_ptr<StreamRW> stream, ostream * plogStream)
-{
-    ReaderIStream is(stream->preader());
-    WriterOStream os(stream->pwriter());
-    stream = nullptr; // remove reference
-    string messages;
-    connectionHandler(is, os, messages);
-    *plogStream << messages << flush;
-}
-
-int main()
-{
-    ifstream is("dec-key.txt");
-    ofstream logFile("/var/www/people-counter-log.txt", ios::app);
-    if(is)
+    if(access(keyFileName.c_str(), F_OK) == 0)
     {
-        string modulus, exponent;
-        is >> modulus >> exponent;
-        is.close();
         try
         {
-            decryptionExponent = BigUnsigned::parseHexByteString(exponent);
-            decryptionModulus = BigUnsigned::parseHexByteString(modulus);
+            setKeyRing(loadKeyRing(keyFileName));
         }
         catch(exception & e)
         {
-            cerr << "Error : can't load key from dec-key.txt : " << e.what() << endl;
+            cerr << "Error : " << e.what() << endl;
             return 1;
         }
     }
     else
         cout << "no decryption key loaded\n";
-    NetworkServer server(12347);
-    for(;;)
+    requestMemoryBudget = make_shared<MemoryBudget>(max(maxInFlightSize, 0L));
     {
-        auto connection = server.accept();
-        connectionThreadFn(connection, &logFile);
-    }
+        RequestScheduler scheduler(requestLaneCostLimits, chrono::milliseconds(max(schedulerAgingInterval, 0L)), max(handlerThreadCount, 0L));
+        RequestScheduler receivePool(vector<size_t>(), chrono::milliseconds(0), max(receiveThreadCount, 1L));
+        NetworkServer server(12347);
+        atomic<bool> stopping(false);
+        thread stopThread([&stopSignals, &stopping, &server]()
+        {
+            int signal;
+            while(sigwait(&stopSignals, &signal) != 0)
+            {
+            }
+            stopping = true;
+            server.shutdown();
+        });
+        uint64_t connectionCount = 0;
+        atomic<size_t> receivingConnectionCount(0);
+        for(;;)
+        {
+            /* this thread only accepts, the receive pool's threads receive the requests and estimate their cost,
+             * then the scheduler threads handle them. The receive timeout bounds how long a slow client holds a receive thread,
+             * and connections past --max-receiving-connections are refused rather than queued. */
+            shared_ptr<NetworkConnection> connection;
+            string sourceAddress;
+            TRACE_SET_ID(0);
+            try
+            {
+                TRACE_SCOPE("accept");
+                connection = server.accept(sourceAddress);
+            }
+            catch(exception & e)
+            {
+                if(stopping)
+                    break;
+                cerr << "Error : " << e.what() << endl;
+                continue;
+            }
+            chrono::steady_clock::time_point acceptTime = chrono::steady_clock::now();
+            uint64_t traceId = ++connectionCount;
+            LogWriter * plogWriter = logWriter.get();
+            if(receivingConnectionCount >= (size_t)max(maxReceivingConnectionCount, 1L))
+            {
+                try
+                {
+                    shared_ptr<Writer> writer = connection->pwriter();
+                    connection = nullptr;
+                    writer->writeByte((uint8_t)'0');
+                    writer->flush();
+                }
+                catch(IOException & e)
+                {
+                }
+                if(plogWriter)
+                    plogWriter->write("Error : " + sourceAddress + " : too many connections receiving\n");
+                continue;
+            }
+            receivingConnectionCount++;
+            size_t maxSize = max(maxRequestSize, 0L);
+            chrono::seconds timeout(max(receiveTimeout, 0L));
+            receivePool.submit(0, [connection, sourceAddress, plogWriter, &scheduler, maxSize, traceId, acceptTime, timeout, &receivingConnectionCount]()
+            {
+                receiveThreadFn(connection, sourceAddress, plogWriter, scheduler, maxSize, traceId, acceptTime, timeout);
+                receivingConnectionCount--;
+            });
+        }
+        stopThread.join();
+        // the receive timeout bounds how long the receiving connections take to hand their requests to the scheduler
+        while(receivingConnectionCount > 0)
+            this_thread::sleep_for(chrono::milliseconds(10));
+    } // the scheduler finishes the queued requests when it's destroyed
+    eventSinks.clear(); // the sinks write the events they buffer when they're destroyed
     return 0;
 }
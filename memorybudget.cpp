@@ -0,0 +1,155 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "memorybudget.h"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace std;
+
+MemoryBudget::MemoryBudget(size_t maxSize)
+    : maxSize(maxSize)
+{
+}
+
+bool MemoryBudget::tryReserve(size_t size)
+{
+    lock_guard<mutex> lockIt(lock);
+    if(size > maxSize - usedSize)
+        return false;
+    usedSize += size;
+    return true;
+}
+
+void MemoryBudget::release(size_t size)
+{
+    lock_guard<mutex> lockIt(lock);
+    usedSize -= size;
+}
+
+size_t MemoryBudget::getUsedSize()
+{
+    lock_guard<mutex> lockIt(lock);
+    return usedSize;
+}
+
+namespace
+{
+class SpillBufferReader final : public Reader
+{
+private:
+    const string & memory;
+    size_t memoryOffset = 0;
+    const int fd;
+    const size_t fileSize;
+    size_t fileOffset = 0;
+    char buffer[16384];
+    size_t bufferOffset = 0;
+    size_t bufferSize = 0;
+public:
+    SpillBufferReader(const string & memory, int fd, size_t fileSize)
+        : memory(memory), fd(fd), fileSize(fileSize)
+    {
+    }
+    virtual uint8_t readByte() override
+    {
+        if(memoryOffset < memory.size())
+            return memory[memoryOffset++];
+        if(bufferOffset == bufferSize)
+        {
+            if(fileOffset >= fileSize)
+                throw EOFException();
+            ssize_t retval = pread(fd, buffer, min(sizeof(buffer), fileSize - fileOffset), fileOffset);
+            if(retval == -1 && errno == EINTR)
+                return readByte();
+            if(retval <= 0)
+                throw IOException(string("IO Error : can't read the spill file : ") + (retval == 0 ? "unexpected end" : strerror(errno)));
+            bufferOffset = 0;
+            bufferSize = retval;
+            fileOffset += retval;
+        }
+        return buffer[bufferOffset++];
+    }
+};
+}
+
+SpillBuffer::SpillBuffer(shared_ptr<MemoryBudget> budget, size_t memorySize, string directory)
+    : budget(budget), memorySize(memorySize), directory(directory)
+{
+}
+
+SpillBuffer::~SpillBuffer()
+{
+    if(fd != -1)
+        close(fd);
+    if(budget)
+        budget->release(reservedSize);
+}
+
+void SpillBuffer::appendSlow(char ch)
+{
+    if(fd == -1)
+    {
+        // grow the memory in steps while the budget allows, so what's reserved is what's allocated
+        size_t growSize = min(max(reservedSize, (size_t)4096), memorySize - reservedSize);
+        if(growSize > 0 && (!budget || budget->tryReserve(growSize)))
+        {
+            reservedSize += growSize;
+            memory.reserve(reservedSize);
+            memory += ch;
+            return;
+        }
+        string fileName = directory + "/pc-spill-XXXXXX";
+        fd = mkstemp(&fileName[0]);
+        if(fd == -1)
+            throw IOException("IO Error : can't create a spill file in " + directory + " : " + strerror(errno));
+        unlink(fileName.c_str());
+    }
+    fileBuffer += ch;
+    if(fileBuffer.size() >= 16384)
+        writeFileBuffer();
+}
+
+void SpillBuffer::writeFileBuffer()
+{
+    const char * pbuffer = fileBuffer.data();
+    size_t sizeLeft = fileBuffer.size();
+    while(sizeLeft > 0)
+    {
+        ssize_t retval = pwrite(fd, pbuffer, sizeLeft, fileSize);
+        if(retval == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            throw IOException(string("IO Error : can't write the spill file : ") + strerror(errno));
+        }
+        sizeLeft -= retval;
+        pbuffer += retval;
+        fileSize += retval;
+    }
+    fileBuffer.clear();
+}
+
+shared_ptr<Reader> SpillBuffer::preader()
+{
+    if(fd != -1)
+        writeFileBuffer();
+    return make_shared<SpillBufferReader>(memory, fd, fileSize);
+}
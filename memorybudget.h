@@ -0,0 +1,88 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef MEMORYBUDGET_H_INCLUDED
+#define MEMORYBUDGET_H_INCLUDED
+
+#include "stream.h"
+#include <mutex>
+#include <memory>
+#include <string>
+#include <cstddef>
+
+using namespace std;
+
+/** a byte count shared by everything that holds memory for requests in flight */
+class MemoryBudget final
+{
+    MemoryBudget(const MemoryBudget &) = delete;
+    const MemoryBudget & operator =(const MemoryBudget &) = delete;
+private:
+    mutex lock;
+    const size_t maxSize;
+    size_t usedSize = 0;
+public:
+    explicit MemoryBudget(size_t maxSize);
+    /** @return if size bytes were reserved, false if that would go over the budget */
+    bool tryReserve(size_t size);
+    void release(size_t size);
+    size_t getUsedSize();
+};
+
+/** holds the bytes appended to it in memory, as far as budget and memorySize allow, and the rest in a temporary file in directory.
+ * The memory taken from budget is given back when the buffer is destroyed.
+ */
+class SpillBuffer final
+{
+    SpillBuffer(const SpillBuffer &) = delete;
+    const SpillBuffer & operator =(const SpillBuffer &) = delete;
+private:
+    const shared_ptr<MemoryBudget> budget;
+    const size_t memorySize;
+    const string directory;
+    string memory;
+    size_t reservedSize = 0;
+    int fd = -1;
+    string fileBuffer; // appended bytes that aren't written to the file yet
+    size_t fileSize = 0;
+    void appendSlow(char ch);
+    void writeFileBuffer();
+public:
+    /** @param budget null to not limit the memory used by all buffers together */
+    SpillBuffer(shared_ptr<MemoryBudget> budget, size_t memorySize, string directory);
+    ~SpillBuffer();
+    void append(char ch)
+    {
+        if(fd == -1 && memory.size() < reservedSize)
+            memory += ch;
+        else
+            appendSlow(ch);
+    }
+    void append(const char * bytes, size_t size)
+    {
+        for(size_t i = 0; i < size; i++)
+            append(bytes[i]);
+    }
+    size_t size() const
+    {
+        return memory.size() + fileSize + fileBuffer.size();
+    }
+    /** @return a reader for the bytes appended so far, which mustn't outlive the buffer or be used after more bytes are appended */
+    shared_ptr<Reader> preader();
+};
+
+#endif // MEMORYBUDGET_H_INCLUDED
@@ -23,7 +23,10 @@
 #include <errno.h>
 #include <signal.h>
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/time.h>
 #include <vector>
+#include <algorithm>
 
 using namespace std;
 
@@ -57,6 +60,13 @@ public:
     }
     virtual ~NetworkWriter()
     {
+        try
+        {
+            flush(); // send the response before closing
+        }
+        catch(IOException & e)
+        {
+        }
         close(fd);
     }
     virtual void writeByte(uint8_t v)
@@ -89,6 +99,57 @@ public:
 };
 }
 
+NetworkReader::~NetworkReader()
+{
+    close(fd);
+}
+
+uint8_t NetworkReader::readByte()
+{
+    if(offset == size)
+    {
+        ssize_t retval;
+        do
+        {
+            if(deadline != chrono::steady_clock::time_point::max())
+            {
+                // wait for data no longer than the time left, then recv doesn't block
+                chrono::steady_clock::duration timeLeft = deadline - chrono::steady_clock::now();
+                pollfd pfd = {fd, POLLIN, 0};
+                int pollRetval = timeLeft.count() <= 0 ? 0 : poll(&pfd, 1, (int)min<int64_t>(chrono::duration_cast<chrono::milliseconds>(timeLeft).count() + 1, 1 << 30));
+                if(pollRetval == -1 && errno == EINTR)
+                {
+                    retval = -1;
+                    continue;
+                }
+                if(pollRetval == 0)
+                    throw NetworkException("io error : receive timed out");
+            }
+            retval = recv(fd, (void *)buffer, sizeof(buffer), 0);
+        }
+        while(retval == -1 && errno == EINTR);
+        if(retval == -1)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                throw NetworkException("io error : receive timed out");
+            throw NetworkException(string("io error : ") + strerror(errno));
+        }
+        if(retval == 0)
+            throw EOFException();
+        offset = 0;
+        size = retval;
+    }
+    return buffer[offset++];
+}
+
+NetworkConnection::NetworkConnection(int fd)
+    : writeFd(fd)
+{
+    networkReader = new NetworkReader(dup(fd));
+    readerInternal = shared_ptr<Reader>(networkReader);
+    writerInternal = shared_ptr<Writer>(new NetworkWriter(fd));
+}
+
 NetworkConnection::NetworkConnection(string url, uint16_t port)
 {
     string url_utf8 = url, port_str = to_string((unsigned)port);
@@ -139,9 +200,18 @@ NetworkConnection::NetworkConnection(string url, uint16_t port)
     freeaddrinfo(addrList);
     readerInternal = unique_ptr<Reader>(new FileReader(fdopen(dup(fd), "r")));
     writerInternal = unique_ptr<Writer>(new NetworkWriter(fd));
+    writeFd = fd;
 }
 
-NetworkServer::NetworkServer(uint16_t port)
+void NetworkConnection::shutdownWriting()
+{
+    writerInternal->flush();
+    if(shutdown(writeFd, SHUT_WR) == -1)
+        throw NetworkException(string("shutdown: ") + strerror(errno));
+}
+
+NetworkServer::NetworkServer(uint16_t port, chrono::milliseconds receiveTimeout)
+    : receiveTimeout(receiveTimeout)
 {
     addrinfo hints;
     memset((void *)&hints, 0, sizeof(hints));
@@ -210,9 +280,22 @@ NetworkServer::~NetworkServer()
     close(fd);
 }
 
+void NetworkServer::shutdown()
+{
+    ::shutdown(fd, SHUT_RDWR);
+}
+
 shared_ptr<StreamRW> NetworkServer::accept()
 {
-    int fd2 = ::accept(fd, nullptr, nullptr);
+    string peerAddress;
+    return accept(peerAddress);
+}
+
+shared_ptr<NetworkConnection> NetworkServer::accept(string & peerAddress)
+{
+    sockaddr_storage address;
+    socklen_t addressLength = sizeof(address);
+    int fd2 = ::accept(fd, (sockaddr *)&address, &addressLength);
 
     if(fd2 < 0)
     {
@@ -223,8 +306,19 @@ shared_ptr<StreamRW> NetworkServer::accept()
 
     int flag = 1;
     setsockopt(fd2, IPPROTO_TCP, TCP_NODELAY, (const void *)&flag, sizeof(flag));
+    if(receiveTimeout.count() > 0)
+    {
+        timeval timeout;
+        timeout.tv_sec = receiveTimeout.count() / 1000;
+        timeout.tv_usec = receiveTimeout.count() % 1000 * 1000;
+        setsockopt(fd2, SOL_SOCKET, SO_RCVTIMEO, (const void *)&timeout, sizeof(timeout));
+    }
+
+    char host[NI_MAXHOST];
+    if(getnameinfo((const sockaddr *)&address, addressLength, host, sizeof(host), nullptr, 0, NI_NUMERICHOST) == 0)
+        peerAddress = host;
+    else
+        peerAddress.clear();
 
-    shared_ptr<Reader> reader = shared_ptr<Reader>(new FileReader(fdopen(dup(fd2), "r")));
-    shared_ptr<Writer> writer = shared_ptr<Writer>(new NetworkWriter(fd2));
-    return shared_ptr<StreamRW>(new StreamRWWrapper(reader, writer));
+    return shared_ptr<NetworkConnection>(new NetworkConnection(fd2));
 }
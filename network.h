@@ -20,6 +20,7 @@
 
 #include "stream.h"
 #include <memory>
+#include <chrono>
 
 class NetworkException : public IOException
 {
@@ -30,18 +31,48 @@ public:
     }
 };
 
+/** reads from a socket, throws NetworkException when the socket's receive timeout or the deadline expires */
+class NetworkReader final : public Reader
+{
+private:
+    int fd;
+    uint8_t buffer[16384];
+    size_t offset = 0;
+    size_t size = 0;
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max();
+public:
+    explicit NetworkReader(int fd)
+        : fd(fd)
+    {
+    }
+    virtual ~NetworkReader();
+    virtual uint8_t readByte() override;
+    /** @param deadline when reading stops waiting for data, however much arrives before it */
+    void setDeadline(chrono::steady_clock::time_point deadline)
+    {
+        this->deadline = deadline;
+    }
+};
+
 class NetworkConnection final : public StreamRW
 {
     friend class NetworkServer;
 private:
     shared_ptr<Reader> readerInternal;
     shared_ptr<Writer> writerInternal;
-    NetworkConnection(int readFd, int writeFd)
-        : readerInternal(new FileReader(fdopen(readFd, "r"))), writerInternal(new FileWriter(fdopen(writeFd, "w")))
-    {
-    }
+    NetworkReader * networkReader = nullptr;
+    int writeFd;
+    explicit NetworkConnection(int fd);
 public:
     explicit NetworkConnection(string url, uint16_t port);
+    /** flushes the writer and tells the peer that nothing more will be sent, the reader stays usable */
+    void shutdownWriting();
+    /** @param deadline when reading from the connection stops waiting, ignored for client connections */
+    void setReceiveDeadline(chrono::steady_clock::time_point deadline)
+    {
+        if(networkReader)
+            networkReader->setDeadline(deadline);
+    }
     shared_ptr<Reader> preader() override
     {
         return readerInternal;
@@ -58,10 +89,16 @@ class NetworkServer final : public StreamServer
     const NetworkServer & operator =(const NetworkServer &) = delete;
 private:
     int fd;
+    const chrono::milliseconds receiveTimeout;
 public:
-    explicit NetworkServer(uint16_t port);
+    /** @param receiveTimeout how long reading from accepted connections waits for data before failing, 0 to wait forever */
+    explicit NetworkServer(uint16_t port, chrono::milliseconds receiveTimeout = chrono::milliseconds(0));
     ~NetworkServer();
     shared_ptr<StreamRW> accept() override;
+    /** @param peerAddress set to the numeric address of the peer */
+    shared_ptr<NetworkConnection> accept(string & peerAddress);
+    /** stops accepting, a waiting accept throws */
+    void shutdown();
 };
 
 #endif // NETWORK_H_INCLUDED
@@ -0,0 +1,140 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "queryserver.h"
+#include <sstream>
+#include <thread>
+#include <atomic>
+
+using namespace std;
+
+namespace
+{
+string getRestOfLine(istream & is)
+{
+    string retval;
+    getline(is >> ws, retval);
+    return retval;
+}
+
+/** @return str with the characters that would break the line protocol escaped */
+string escape(const string & str)
+{
+    string retval;
+    retval.reserve(str.size());
+    for(char ch : str)
+    {
+        if(ch == '\\')
+            retval += "\\\\";
+        else if(ch == '\n')
+            retval += "\\n";
+        else if(ch == '\r')
+            retval += "\\r";
+        else
+            retval += ch;
+    }
+    return retval;
+}
+}
+
+void queryConnectionHandler(ReaderIStream & is, WriterOStream & os, const EventIndex & index)
+{
+    string line;
+    while(getline(is, line))
+    {
+        if(!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        istringstream ss(line);
+        string command;
+        ss >> command;
+        if(command == "count")
+        {
+            long long startTime, endTime;
+            if(!(ss >> startTime >> endTime))
+                os << "error usage : count <start time> <end time> <device name>\n";
+            else
+                os << "count " << index.count(getRestOfLine(ss), startTime, endTime) << "\n";
+        }
+        else if(command == "lastseen")
+        {
+            index.lastSeen(getRestOfLine(ss), [&os](const string & deviceName, time_t lastReceiveTime, time_t lastDeviceTime)
+            {
+                os << "lastseen " << lastReceiveTime << " " << lastDeviceTime << " " << escape(deviceName) << "\n";
+            });
+        }
+        else if(command == "recent")
+        {
+            size_t maxCount;
+            if(!(ss >> maxCount))
+                os << "error usage : recent <max count> <device name>\n";
+            else
+            {
+                index.recent(getRestOfLine(ss), maxCount, [&os](const Event & event)
+                {
+                    os << "event " << event.deviceTime << " " << event.receiveTime << " " << escape(event.text) << "\n";
+                });
+            }
+        }
+        else if(command != "")
+            os << "error unknown command\n";
+        else
+            continue;
+        os << "end" << endl;
+    }
+    is.close();
+    os.close();
+}
+
+QueryServer::QueryServer(uint16_t port, shared_ptr<const EventIndex> index, chrono::milliseconds receiveTimeout, size_t maxConnectionCount)
+    : server(make_shared<NetworkServer>(port, receiveTimeout)), index(index)
+{
+    shared_ptr<NetworkServer> server = this->server;
+    shared_ptr<atomic<size_t>> connectionCount = make_shared<atomic<size_t>>(0);
+    thread([server, index, connectionCount, maxConnectionCount]()
+    {
+        for(;;)
+        {
+            shared_ptr<StreamRW> connection;
+            try
+            {
+                connection = server->accept();
+            }
+            catch(exception & e)
+            {
+                cerr << "Error : query server : " << e.what() << endl;
+                continue;
+            }
+            if(*connectionCount >= maxConnectionCount)
+            {
+                WriterOStream os(connection->pwriter());
+                os << "error too many connections" << endl;
+                os.close();
+                continue;
+            }
+            (*connectionCount)++;
+            thread([connection, index, connectionCount]()
+            {
+                {
+                    ReaderIStream is(connection->preader());
+                    WriterOStream os(connection->pwriter());
+                    queryConnectionHandler(is, os, *index);
+                }
+                (*connectionCount)--;
+            }).detach();
+        }
+    }).detach();
+}
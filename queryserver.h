@@ -0,0 +1,51 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef QUERYSERVER_H_INCLUDED
+#define QUERYSERVER_H_INCLUDED
+
+#include "network.h"
+#include "eventindex.h"
+#include <memory>
+
+using namespace std;
+
+/** handles one query connection. The client sends one command per line, device names go last so they can contain spaces :
+ *   count <start time> <end time> <device name>   -> "count <n>"
+ *   lastseen [<device name>]                      -> "lastseen <last receive time> <last device time> <device name>" per device
+ *   recent <max count> <device name>              -> "event <device time> <receive time> <text>" per event, oldest first
+ * Times are seconds since the epoch. Every response is terminated by "end", errors are reported as "error <message>".
+ * Backslashes, line feeds and carriage returns in device names and event texts are sent as \\, \n and \r.
+ */
+void queryConnectionHandler(ReaderIStream & is, WriterOStream & os, const EventIndex & index);
+
+/** accepts query connections on a separate port, each connection is handled on its own thread.
+ * Connections past maxConnectionCount are refused with an error.
+ */
+class QueryServer final
+{
+    QueryServer(const QueryServer &) = delete;
+    const QueryServer & operator =(const QueryServer &) = delete;
+private:
+    shared_ptr<NetworkServer> server;
+    shared_ptr<const EventIndex> index;
+public:
+    /** @param receiveTimeout how long a connection may wait for the client's next bytes before it's closed, 0 to wait forever */
+    QueryServer(uint16_t port, shared_ptr<const EventIndex> index, chrono::milliseconds receiveTimeout, size_t maxConnectionCount);
+};
+
+#endif // QUERYSERVER_H_INCLUDED
@@ -0,0 +1,58 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "ratelimit.h"
+#include <algorithm>
+
+using namespace std;
+
+RateLimiter::RateLimiter(double rate, double burst, size_t maxKeyCount)
+    : rate(rate), burst(max(burst, 1.0)), maxKeyCount(max<size_t>(maxKeyCount, 1))
+{
+}
+
+void RateLimiter::refill(Bucket & bucket, chrono::steady_clock::time_point now) const
+{
+    double elapsed = chrono::duration<double>(now - bucket.updateTime).count();
+    bucket.tokens = min(burst, bucket.tokens + elapsed * rate);
+    bucket.updateTime = now;
+}
+
+bool RateLimiter::tryAcquire(const string & key)
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    lock_guard<mutex> lockIt(lock);
+    auto i = buckets.find(key);
+    if(i == buckets.end())
+    {
+        if(buckets.size() >= maxKeyCount)
+        {
+            buckets.erase(useOrder.back());
+            useOrder.pop_back();
+        }
+        useOrder.push_front(key);
+        buckets[key] = Bucket{burst - 1, now, useOrder.begin()};
+        return true;
+    }
+    Bucket & bucket = i->second;
+    useOrder.splice(useOrder.begin(), useOrder, bucket.usePosition);
+    refill(bucket, now);
+    if(bucket.tokens < 1)
+        return false;
+    bucket.tokens -= 1;
+    return true;
+}
@@ -0,0 +1,61 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef RATELIMIT_H_INCLUDED
+#define RATELIMIT_H_INCLUDED
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <list>
+#include <chrono>
+
+using namespace std;
+
+/** token buckets keyed by a string, like a device name or source address.
+ * Every key starts with a full bucket of burst tokens that refills at rate tokens per second, and each request takes one.
+ * At most maxKeyCount buckets are kept : when that's reached the least recently used bucket is dropped,
+ * as it has had the longest to refill, so every key is limited and making room takes constant time.
+ */
+class RateLimiter final
+{
+private:
+    struct Bucket
+    {
+        double tokens;
+        chrono::steady_clock::time_point updateTime;
+        list<string>::iterator usePosition;
+    };
+    mutex lock;
+    unordered_map<string, Bucket> buckets;
+    list<string> useOrder; // the keys of buckets, most recently used first
+    const double rate;
+    const double burst;
+    const size_t maxKeyCount;
+    void refill(Bucket & bucket, chrono::steady_clock::time_point now) const;
+public:
+    /** @param rate tokens added per second
+     * @param burst the bucket size, at least 1
+     */
+    RateLimiter(double rate, double burst, size_t maxKeyCount);
+    /** takes a token from key's bucket
+     * @return if there was one, false if key is over its budget
+     */
+    bool tryAcquire(const string & key);
+};
+
+#endif // RATELIMIT_H_INCLUDED
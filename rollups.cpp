@@ -0,0 +1,261 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "rollups.h"
+#include "stream.h"
+#include "checksum.h"
+#include "binaryio.h"
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <algorithm>
+
+using namespace std;
+
+const time_t EventRollups::Granularities[EventRollups::GranularityCount] = {5 * 60, 60 * 60, 24 * 60 * 60};
+
+namespace
+{
+const char fileMagic[8] = {'P', 'C', 'R', 'O', 'L', 'U', 'P', '\0'};
+
+int64_t getBucketIndex(time_t t, time_t bucketSeconds)
+{
+    int64_t retval = t / bucketSeconds;
+    if(t % bucketSeconds < 0)
+        retval--;
+    return retval;
+}
+
+uint64_t getKey(uint32_t deviceId, int64_t bucketIndex)
+{
+    return ((uint64_t)deviceId << 32) | (uint32_t)bucketIndex;
+}
+}
+
+EventRollups::EventRollups(string fileName, chrono::seconds flushInterval, bool readOnly)
+    : fileName(fileName), flushInterval(flushInterval), readOnly(readOnly)
+{
+    if(fileName == "")
+        return;
+    load();
+    if(readOnly)
+        return;
+    flushThread = thread(&EventRollups::flushFn, this);
+}
+
+EventRollups::~EventRollups()
+{
+    if(!flushThread.joinable())
+        return;
+    flushLock.lock();
+    done = true;
+    flushCond.notify_all();
+    flushLock.unlock();
+    flushThread.join();
+    try
+    {
+        flush();
+    }
+    catch(exception & e)
+    {
+        cerr << "Error : " << e.what() << endl;
+    }
+}
+
+size_t EventRollups::getGranularityIndex(time_t bucketSeconds)
+{
+    for(size_t i = 0; i < GranularityCount; i++)
+    {
+        if(Granularities[i] == bucketSeconds)
+            return i;
+    }
+    return GranularityCount;
+}
+
+uint32_t EventRollups::getDeviceId(const string & deviceName)
+{
+    auto iter = deviceIds.find(deviceName);
+    if(iter != deviceIds.end())
+        return get<1>(*iter);
+    uint32_t retval = deviceNames.size();
+    deviceNames.push_back(deviceName);
+    deviceIds[deviceName] = retval;
+    return retval;
+}
+
+void EventRollups::add(uint32_t deviceId, time_t deviceTime, uint64_t count)
+{
+    for(size_t i = 0; i < GranularityCount; i++)
+        tables[i][getKey(deviceId, getBucketIndex(deviceTime, Granularities[i]))] += count;
+}
+
+void EventRollups::writeEvents(const string & deviceName, const vector<Event> & events)
+{
+    lock_guard<mutex> lockIt(lock);
+    uint32_t deviceId = getDeviceId(deviceName);
+    for(const Event & event : events)
+        add(deviceId, event.deviceTime, 1);
+}
+
+void EventRollups::query(const string & deviceName, size_t granularityIndex, time_t startTime, time_t endTime, function<void(time_t bucketStart, uint64_t count)> fn) const
+{
+    if(granularityIndex >= GranularityCount || startTime > endTime)
+        return;
+    time_t bucketSeconds = Granularities[granularityIndex];
+    vector<pair<time_t, uint64_t>> buckets;
+    {
+        lock_guard<mutex> lockIt(lock);
+        auto iter = deviceIds.find(deviceName);
+        if(iter == deviceIds.end())
+            return;
+        uint32_t deviceId = get<1>(*iter);
+        const unordered_map<uint64_t, uint64_t> & table = tables[granularityIndex];
+        int64_t firstBucket = getBucketIndex(startTime, bucketSeconds), lastBucket = getBucketIndex(endTime, bucketSeconds);
+        if((uint64_t)(lastBucket - firstBucket) < table.size())
+        {
+            for(int64_t bucket = firstBucket; bucket <= lastBucket; bucket++)
+            {
+                auto countIter = table.find(getKey(deviceId, bucket));
+                if(countIter != table.end())
+                    buckets.push_back(make_pair((time_t)(bucket * bucketSeconds), get<1>(*countIter)));
+            }
+        }
+        else
+        {
+            // the range has more buckets than are stored, like when it starts at 0, so look at the stored ones instead
+            for(const pair<const uint64_t, uint64_t> & entry : table)
+            {
+                int64_t bucket = (int32_t)(uint32_t)get<0>(entry);
+                if(get<0>(entry) >> 32 == deviceId && bucket >= firstBucket && bucket <= lastBucket)
+                    buckets.push_back(make_pair((time_t)(bucket * bucketSeconds), get<1>(entry)));
+            }
+            sort(buckets.begin(), buckets.end());
+        }
+    }
+    for(const pair<time_t, uint64_t> & bucket : buckets)
+        fn(get<0>(bucket), get<1>(bucket));
+}
+
+void EventRollups::flush()
+{
+    if(fileName == "" || readOnly)
+        return;
+    string buffer(fileMagic, sizeof(fileMagic));
+    {
+        lock_guard<mutex> lockIt(lock);
+        appendLittleEndian(buffer, deviceNames.size(), 4);
+        for(const string & deviceName : deviceNames)
+        {
+            appendLittleEndian(buffer, min<size_t>(deviceName.size(), 0xFFFF), 2);
+            buffer.append(deviceName, 0, 0xFFFF);
+        }
+        appendLittleEndian(buffer, GranularityCount, 4);
+        for(size_t i = 0; i < GranularityCount; i++)
+        {
+            appendLittleEndian(buffer, Granularities[i], 4);
+            appendLittleEndian(buffer, tables[i].size(), 4);
+            for(const pair<const uint64_t, uint64_t> & entry : tables[i])
+            {
+                appendLittleEndian(buffer, get<0>(entry) >> 32, 4);
+                appendLittleEndian(buffer, (uint64_t)((int64_t)(int32_t)(uint32_t)get<0>(entry) * Granularities[i]), 8);
+                appendLittleEndian(buffer, get<1>(entry), 8);
+            }
+        }
+    }
+    appendLittleEndian(buffer, crc32(buffer.data(), buffer.size()), 4);
+    string tempFileName = fileName + ".tmp";
+    FILE * f = fopen(tempFileName.c_str(), "wb");
+    if(f == nullptr)
+        throw IOException("IO Error : can't create " + tempFileName + " : " + strerror(errno));
+    bool failed = (fwrite(buffer.data(), 1, buffer.size(), f) != buffer.size());
+    if(fclose(f) != 0 || failed)
+        throw IOException("IO Error : can't write to " + tempFileName);
+    if(rename(tempFileName.c_str(), fileName.c_str()) == -1)
+        throw IOException("IO Error : can't rename " + tempFileName + " : " + strerror(errno));
+}
+
+void EventRollups::load()
+{
+    ifstream is(fileName.c_str(), ios::binary);
+    if(!is)
+        return; // nothing saved yet
+    string contents((istreambuf_iterator<char>(is)), istreambuf_iterator<char>());
+    const uint8_t * bytes = (const uint8_t *)contents.data();
+    size_t location = sizeof(fileMagic);
+    auto need = [&](size_t byteCount)
+    {
+        if(contents.size() - location < byteCount)
+            throw IOException("IO Error : invalid rollup file " + fileName);
+    };
+    if(contents.size() < sizeof(fileMagic) + 4 || memcmp(bytes, fileMagic, sizeof(fileMagic)) != 0
+       || crc32(bytes, contents.size() - 4) != readLittleEndian(bytes + contents.size() - 4, 4))
+        throw IOException("IO Error : invalid rollup file " + fileName);
+    contents.resize(contents.size() - 4);
+    need(4);
+    size_t deviceCount = readLittleEndian(bytes + location, 4);
+    location += 4;
+    vector<uint32_t> ids;
+    for(size_t i = 0; i < deviceCount; i++)
+    {
+        need(2);
+        size_t size = readLittleEndian(bytes + location, 2);
+        location += 2;
+        need(size);
+        ids.push_back(getDeviceId(string((const char *)bytes + location, size)));
+        location += size;
+    }
+    need(4);
+    size_t granularityCount = readLittleEndian(bytes + location, 4);
+    location += 4;
+    for(size_t i = 0; i < granularityCount; i++)
+    {
+        need(8);
+        size_t granularityIndex = getGranularityIndex(readLittleEndian(bytes + location, 4));
+        size_t entryCount = readLittleEndian(bytes + location + 4, 4);
+        location += 8;
+        need(entryCount * 20);
+        for(size_t j = 0; j < entryCount; j++, location += 20)
+        {
+            size_t deviceIndex = readLittleEndian(bytes + location, 4);
+            if(granularityIndex == GranularityCount || deviceIndex >= ids.size())
+                continue;
+            time_t bucketStart = (time_t)(int64_t)readLittleEndian(bytes + location + 4, 8);
+            tables[granularityIndex][getKey(ids[deviceIndex], getBucketIndex(bucketStart, Granularities[granularityIndex]))] += readLittleEndian(bytes + location + 12, 8);
+        }
+    }
+}
+
+void EventRollups::flushFn()
+{
+    unique_lock<mutex> lockIt(flushLock);
+    while(!done)
+    {
+        flushCond.wait_for(lockIt, flushInterval);
+        if(done)
+            break;
+        lockIt.unlock();
+        try
+        {
+            flush();
+        }
+        catch(exception & e)
+        {
+            cerr << "Error : " << e.what() << endl;
+        }
+        lockIt.lock();
+    }
+}
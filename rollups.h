@@ -0,0 +1,74 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef ROLLUPS_H_INCLUDED
+#define ROLLUPS_H_INCLUDED
+
+#include "eventsink.h"
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+using namespace std;
+
+/** per device event counts in 5 minute, hour and day buckets of device time, updated as events arrive.
+ * The tables are periodically written to a file, which is loaded again at startup.
+ *
+ * file layout (little endian) : "PCROLUP" + NUL, u32 device count, devices (u16 length + name),
+ *   u32 granularity count, then per granularity : u32 bucket seconds, u32 entry count, entries (u32 device id, i64 bucket start, u64 count),
+ *   u32 CRC-32 of everything before it
+ */
+class EventRollups final : public EventSink
+{
+public:
+    static const size_t GranularityCount = 3;
+    static const time_t Granularities[GranularityCount];
+private:
+    mutable mutex lock;
+    unordered_map<string, uint32_t> deviceIds;
+    vector<string> deviceNames;
+    unordered_map<uint64_t, uint64_t> tables[GranularityCount]; // keyed by device id and bucket index
+    const string fileName;
+    const chrono::seconds flushInterval;
+    const bool readOnly;
+    mutex flushLock;
+    condition_variable flushCond;
+    bool done = false;
+    thread flushThread;
+    uint32_t getDeviceId(const string & deviceName);
+    void add(uint32_t deviceId, time_t deviceTime, uint64_t count);
+    void load();
+    void flushFn();
+public:
+    /** @param fileName where the tables are written, no file is used if it's empty
+     * @param readOnly if the tables are only loaded from fileName and never written back
+     */
+    EventRollups(string fileName, chrono::seconds flushInterval, bool readOnly = false);
+    ~EventRollups();
+    virtual void writeEvents(const string & deviceName, const vector<Event> & events) override;
+    /** @return the bucket granularity index for bucketSeconds, or GranularityCount if there isn't one */
+    static size_t getGranularityIndex(time_t bucketSeconds);
+    /** calls fn with the start and count of every non-empty bucket overlapping startTime to endTime, in order */
+    void query(const string & deviceName, size_t granularityIndex, time_t startTime, time_t endTime, function<void(time_t bucketStart, uint64_t count)> fn) const;
+    void flush();
+};
+
+#endif // ROLLUPS_H_INCLUDED
@@ -0,0 +1,121 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "scheduler.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+size_t getThreadCount(size_t threadCount)
+{
+    if(threadCount == 0)
+        threadCount = thread::hardware_concurrency();
+    return max<size_t>(threadCount, 1);
+}
+}
+
+RequestScheduler::RequestScheduler(vector<size_t> laneCostLimits, chrono::steady_clock::duration agingLimit, size_t threadCount)
+    : laneCostLimits(laneCostLimits), lanes(laneCostLimits.size() + 1), runningCounts(laneCostLimits.size() + 1, 0),
+      agingLimit(agingLimit), threadCount(getThreadCount(threadCount))
+{
+    for(size_t i = 0; i < this->threadCount; i++)
+        threads.push_back(thread(&RequestScheduler::workerFn, this));
+}
+
+RequestScheduler::~RequestScheduler()
+{
+    lock.lock();
+    done = true;
+    cond.notify_all();
+    lock.unlock();
+    for(thread & t : threads)
+        t.join();
+}
+
+void RequestScheduler::submit(size_t cost, function<void()> fn)
+{
+    size_t lane = 0;
+    while(lane < laneCostLimits.size() && cost > laneCostLimits[lane])
+        lane++;
+    lock.lock();
+    lanes[lane].push_back(Job{move(fn), chrono::steady_clock::now(), lane});
+    queuedCount++;
+    cond.notify_one();
+    lock.unlock();
+}
+
+size_t RequestScheduler::queuedRequestCount()
+{
+    lock_guard<mutex> lockIt(lock);
+    return queuedCount;
+}
+
+bool RequestScheduler::canStart(size_t lane) const
+{
+    size_t runningCount = 0;
+    for(size_t i = lane; i < runningCounts.size(); i++)
+        runningCount += runningCounts[i];
+    return runningCount < max<size_t>(threadCount > lane ? threadCount - lane : 0, 1);
+}
+
+bool RequestScheduler::popJob(Job & job)
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    size_t chosenLane = lanes.size();
+    for(size_t i = 0; i < lanes.size(); i++)
+    {
+        if(lanes[i].empty() || now - lanes[i].front().submitTime < agingLimit || !canStart(i))
+            continue;
+        if(chosenLane == lanes.size() || lanes[i].front().submitTime < lanes[chosenLane].front().submitTime)
+            chosenLane = i;
+    }
+    for(size_t i = 0; i < lanes.size() && chosenLane == lanes.size(); i++)
+    {
+        if(!lanes[i].empty() && canStart(i))
+            chosenLane = i;
+    }
+    if(chosenLane == lanes.size())
+        return false;
+    job = move(lanes[chosenLane].front());
+    lanes[chosenLane].pop_front();
+    queuedCount--;
+    runningCounts[chosenLane]++;
+    return true;
+}
+
+void RequestScheduler::workerFn()
+{
+    unique_lock<mutex> lockIt(lock);
+    Job job;
+    for(;;)
+    {
+        while(!popJob(job))
+        {
+            if(done && queuedCount == 0)
+                return;
+            cond.wait(lockIt);
+        }
+        lockIt.unlock();
+        job.fn();
+        job.fn = nullptr; // release what the job holds before waiting again
+        lockIt.lock();
+        runningCounts[job.lane]--;
+        cond.notify_all(); // jobs of the lane may be able to start now
+    }
+}
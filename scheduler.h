@@ -0,0 +1,75 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef SCHEDULER_H_INCLUDED
+#define SCHEDULER_H_INCLUDED
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+/** runs requests on a fixed set of threads, cheap requests first.
+ * Requests go into the first lane whose cost limit their estimated cost doesn't exceed, or the last lane.
+ * Workers take the oldest request of the cheapest non empty lane, except that requests that waited longer than
+ * the aging limit go first, oldest first, so expensive requests are delayed but never starved.
+ * Lane n and the lanes after it together run on at most threadCount - n threads (but at least 1),
+ * so a flood of expensive requests can't take the threads the cheaper lanes need.
+ */
+class RequestScheduler final
+{
+    RequestScheduler(const RequestScheduler &) = delete;
+    const RequestScheduler & operator =(const RequestScheduler &) = delete;
+private:
+    struct Job
+    {
+        function<void()> fn;
+        chrono::steady_clock::time_point submitTime;
+        size_t lane;
+    };
+    mutex lock;
+    condition_variable cond;
+    const vector<size_t> laneCostLimits;
+    vector<deque<Job>> lanes;
+    vector<size_t> runningCounts; // per lane
+    size_t queuedCount = 0;
+    const chrono::steady_clock::duration agingLimit;
+    const size_t threadCount;
+    vector<thread> threads;
+    bool done = false;
+    bool canStart(size_t lane) const;
+    /** @return if a job could be started */
+    bool popJob(Job & job);
+    void workerFn();
+public:
+    /** @param laneCostLimits the highest cost for each lane but the last, in increasing order
+     * @param threadCount 0 means one thread per hardware thread
+     */
+    RequestScheduler(vector<size_t> laneCostLimits, chrono::steady_clock::duration agingLimit, size_t threadCount);
+    /** runs the requests still queued, then stops the threads */
+    ~RequestScheduler();
+    void submit(size_t cost, function<void()> fn);
+    /** @return the number of queued requests that haven't started */
+    size_t queuedRequestCount();
+};
+
+#endif // SCHEDULER_H_INCLUDED
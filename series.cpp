@@ -0,0 +1,102 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "eventseries.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <chrono>
+#include <map>
+
+using namespace std;
+
+int main(int argc, char ** argv)
+{
+    bool countOnly = argc >= 2 && string(argv[1]) == "--count";
+    int argIndex = countOnly ? 2 : 1;
+    if(argc - argIndex != 1 && argc - argIndex != 3)
+    {
+        cerr << "usage : " << argv[0] << " [--count] <series directory> [<start time> <end time>]\n";
+        cerr << "prints the events with a device time in the range, or with --count the number of events of every device\n";
+        return 1;
+    }
+    string directory = argv[argIndex];
+    int64_t startTime = LLONG_MIN, endTime = LLONG_MAX;
+    if(argc - argIndex == 3)
+    {
+        startTime = atoll(argv[argIndex + 1]);
+        endTime = atoll(argv[argIndex + 2]);
+    }
+    size_t eventCount = 0, blockCount = 0, skippedBlockCount = 0, byteCount = 0;
+    map<string, uint64_t> deviceCounts;
+    chrono::steady_clock::time_point decodeStartTime = chrono::steady_clock::now();
+    try
+    {
+        EventSeriesBlock rows;
+        vector<uint64_t> blockDeviceCounts;
+        string output;
+        for(uint32_t segment : EventSeriesWriter::listSegments(directory))
+        {
+            EventSeriesFile file(EventSeriesWriter::getSegmentFileName(directory, segment));
+            for(size_t block = 0; block < file.getBlockCount(); block++)
+            {
+                if(file.getMaxTime(block) < startTime || file.getMinTime(block) > endTime)
+                {
+                    skippedBlockCount++;
+                    continue;
+                }
+                file.decodeBlock(block, rows);
+                blockCount++;
+                byteCount += file.getBlockSize(block);
+                blockDeviceCounts.assign(rows.deviceNames.size(), 0);
+                output.clear();
+                for(size_t row = 0; row < rows.size(); row++)
+                {
+                    if(rows.deviceTimes[row] < startTime || rows.deviceTimes[row] > endTime)
+                        continue;
+                    eventCount++;
+                    if(countOnly)
+                    {
+                        blockDeviceCounts[rows.deviceIds[row]]++;
+                        continue;
+                    }
+                    output.append("Event : ").append(rows.deviceNames[rows.deviceIds[row]]).append(" : ");
+                    output.append(to_string((long long)rows.deviceTimes[row])).append(" : ");
+                    output.append(rows.texts[rows.textCodes[row]]).append("\n");
+                }
+                for(size_t i = 0; i < blockDeviceCounts.size(); i++)
+                    if(blockDeviceCounts[i] > 0)
+                        deviceCounts[rows.deviceNames[i]] += blockDeviceCounts[i];
+                fwrite(output.data(), 1, output.size(), stdout);
+            }
+        }
+    }
+    catch(exception & e)
+    {
+        cerr << "Error : " << e.what() << endl;
+        return 1;
+    }
+    for(const auto & deviceCount : deviceCounts)
+        cout << deviceCount.first << " " << deviceCount.second << "\n";
+    cout.flush();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - decodeStartTime;
+    fprintf(stderr, "%zu events from %zu blocks (%zu skipped), %.1f MB in %.2f s : %.1f M events/s %.2f MB/s\n",
+            eventCount, blockCount, skippedBlockCount, byteCount / 1e6, elapsed.count(),
+            eventCount / 1e6 / max(elapsed.count(), 1e-9), byteCount / 1e6 / max(elapsed.count(), 1e-9));
+    return 0;
+}
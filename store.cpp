@@ -0,0 +1,92 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "eventstore.h"
+#include "stream.h"
+#include <iostream>
+#include <cstdlib>
+#include <climits>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace
+{
+/** prints the events in the segments of directory whose device time is in [startTime, endTime], oldest segment first,
+ * and reports where a segment is damaged
+ */
+int dumpStore(const string & directory, int64_t startTime, int64_t endTime)
+{
+    size_t eventCount = 0, damagedCount = 0;
+    string line;
+    for(uint32_t number : EventStore::listSegments(directory))
+    {
+        string fileName = EventStore::getSegmentFileName(directory, number);
+        size_t validSize = EventStore::readSegment(fileName, [&](const string & deviceName, const Event & event)
+        {
+            if(event.deviceTime < startTime || event.deviceTime > endTime)
+                return;
+            line.clear();
+            line += deviceName;
+            line += " : " + to_string((long long)event.deviceTime);
+            line += " : " + to_string((long long)event.receiveTime);
+            line += " : " + event.text + "\n";
+            cout << line;
+            eventCount++;
+        });
+        struct stat fileStat;
+        if(stat(fileName.c_str(), &fileStat) == 0 && (size_t)fileStat.st_size != validSize)
+        {
+            if(validSize == 0)
+                cerr << fileName << " : damaged header\n";
+            else
+                cerr << fileName << " : damaged after byte " << validSize << " of " << fileStat.st_size << "\n";
+            damagedCount++;
+        }
+    }
+    cerr << "read " << eventCount << " events";
+    if(damagedCount > 0)
+        cerr << ", " << damagedCount << " damaged segments";
+    cerr << endl;
+    return 0;
+}
+}
+
+int main(int argc, char ** argv)
+{
+    if(argc != 2 && argc != 4)
+    {
+        cerr << "usage : " << argv[0] << " <event store directory> [<start time> <end time>]\n";
+        cerr << "prints device : device time : receive time : text for every stored event, times are seconds since the epoch\n";
+        return 1;
+    }
+    int64_t startTime = LLONG_MIN, endTime = LLONG_MAX;
+    if(argc == 4)
+    {
+        startTime = atoll(argv[2]);
+        endTime = atoll(argv[3]);
+    }
+    try
+    {
+        return dumpStore(argv[1], startTime, endTime);
+    }
+    catch(exception & e)
+    {
+        cerr << "Error : " << e.what() << endl;
+        return 1;
+    }
+}
@@ -85,6 +85,15 @@ public:
     }
 };
 
+class LimitExceededException final : public IOException
+{
+public:
+    explicit LimitExceededException(string msg)
+        : IOException(msg)
+    {
+    }
+};
+
 class Reader
 {
 private:
@@ -205,8 +214,8 @@ public:
     {
     }
     template <size_t length>
-    explicit MemoryReader(const uint8_t a[length])
-        : MemoryReader(shared_ptr<const uint8_t>(&a[0], [](const uint8_t *){}))
+    explicit MemoryReader(const uint8_t (&a)[length])
+        : MemoryReader(shared_ptr<const uint8_t>(&a[0], [](const uint8_t *){}), length)
     {
     }
     virtual uint8_t readByte() override
@@ -217,6 +226,50 @@ public:
     }
 };
 
+/** reads at most maxSize bytes from reader, throws LimitExceededException for more */
+class LimitedReader final : public Reader
+{
+private:
+    const shared_ptr<Reader> reader;
+    const size_t maxSize;
+    size_t remainingSize;
+public:
+    explicit LimitedReader(shared_ptr<Reader> reader, size_t maxSize)
+        : reader(reader), maxSize(maxSize), remainingSize(maxSize)
+    {
+    }
+    virtual uint8_t readByte() override
+    {
+        if(remainingSize == 0)
+        {
+            reader->readByte(); // still reports the end of the stream as EOFException
+            throw LimitExceededException("IO Error : more than " + to_string(maxSize) + " bytes");
+        }
+        remainingSize--;
+        return reader->readByte();
+    }
+};
+
+/** reads the bytes of prefix, then the rest from reader */
+class PrefixedReader final : public Reader
+{
+private:
+    const string prefix;
+    size_t offset = 0;
+    const shared_ptr<Reader> reader;
+public:
+    PrefixedReader(string prefix, shared_ptr<Reader> reader)
+        : prefix(prefix), reader(reader)
+    {
+    }
+    virtual uint8_t readByte() override
+    {
+        if(offset < prefix.size())
+            return prefix[offset++];
+        return reader->readByte();
+    }
+};
+
 class StreamPipe final
 {
     StreamPipe(const StreamPipe &) = delete;
@@ -370,6 +423,7 @@ class ReaderStreamBuf : public streambuf
 {
     shared_ptr<Reader> reader;
     char buffer;
+    string error;
 public:
     ReaderStreamBuf(shared_ptr<Reader> reader)
         : reader(reader)
@@ -379,6 +433,11 @@ public:
     {
         reader = nullptr;
     }
+    /** @return why reading stopped if it wasn't the end of the stream, empty otherwise */
+    const string & getError() const
+    {
+        return error;
+    }
 private:
     int getByteInternal()
     {
@@ -394,8 +453,10 @@ private:
         }
         catch(IOException & e)
         {
+            // the stream ends here too, getError tells it apart from a clean end
+            error = e.what();
+            reader = nullptr;
             return EOF;
-            //TODO: signal error
         }
     }
 protected:
@@ -408,7 +469,7 @@ protected:
         }
         buffer = ch;
         setg(&buffer, &buffer, &buffer + 1);
-        return buffer;
+        return char_traits<char>::to_int_type(buffer);
     }
 };
 
@@ -476,6 +537,11 @@ public:
     {
         sb.close();
     }
+    /** @return why reading stopped if it wasn't the end of the stream, empty otherwise */
+    const string & getReadError() const
+    {
+        return sb.getError();
+    }
 };
 
 class WriterOStream : public ostream
@@ -0,0 +1,203 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "threadpool.h"
+
+using namespace std;
+
+namespace
+{
+thread_local ThreadPool * currentPool = nullptr;
+thread_local size_t currentQueueIndex = 0;
+}
+
+ThreadPool::ThreadPool(size_t threadCount)
+    : queuedCount(0), nextQueue(0)
+{
+    if(threadCount == 0)
+        threadCount = thread::hardware_concurrency();
+    if(threadCount == 0)
+        threadCount = 1;
+    for(size_t i = 0; i < threadCount; i++)
+        queues.push_back(unique_ptr<WorkerQueue>(new WorkerQueue));
+    for(size_t i = 0; i < threadCount; i++)
+        threads.push_back(thread(&ThreadPool::workerFn, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    sleepLock.lock();
+    done = true;
+    sleepCond.notify_all();
+    sleepLock.unlock();
+    for(thread & t : threads)
+        t.join();
+}
+
+ThreadPool & ThreadPool::shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::submit(function<void()> task)
+{
+    size_t index;
+    if(currentPool == this)
+        index = currentQueueIndex;
+    else
+        index = nextQueue++ % queues.size();
+    WorkerQueue & queue = *queues[index];
+    queue.lock.lock();
+    queue.tasks.push_back(move(task));
+    queuedCount++;
+    queue.lock.unlock();
+    sleepLock.lock();
+    sleepCond.notify_one();
+    sleepLock.unlock();
+}
+
+bool ThreadPool::popTask(size_t startIndex, bool isOwnQueue, function<void()> & task)
+{
+    if(queuedCount == 0)
+        return false;
+    for(size_t i = 0; i < queues.size(); i++)
+    {
+        WorkerQueue & queue = *queues[(startIndex + i) % queues.size()];
+        lock_guard<mutex> lockIt(queue.lock);
+        if(queue.tasks.empty())
+            continue;
+        if(i == 0 && isOwnQueue)
+        {
+            task = move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        queuedCount--;
+        return true;
+    }
+    return false;
+}
+
+bool ThreadPool::runPendingTask()
+{
+    function<void()> task;
+    bool isWorker = (currentPool == this);
+    if(!popTask(isWorker ? currentQueueIndex : nextQueue++ % queues.size(), isWorker, task))
+        return false;
+    task();
+    return true;
+}
+
+void ThreadPool::workerFn(size_t index)
+{
+    currentPool = this;
+    currentQueueIndex = index;
+    function<void()> task;
+    for(;;)
+    {
+        if(popTask(index, true, task))
+        {
+            task();
+            task = nullptr;
+            continue;
+        }
+        unique_lock<mutex> lockIt(sleepLock);
+        sleepCond.wait(lockIt, [this]()
+        {
+            return done || queuedCount > 0;
+        });
+        if(done && queuedCount == 0)
+            return;
+    }
+}
+
+TaskGroup::~TaskGroup()
+{
+    try
+    {
+        wait();
+    }
+    catch(...)
+    {
+    }
+}
+
+bool TaskGroup::runQueuedTask(State & state, unique_lock<mutex> & lockIt)
+{
+    if(state.queuedTasks.empty())
+        return false;
+    function<void()> fn = move(state.queuedTasks.front());
+    state.queuedTasks.pop_front();
+    lockIt.unlock();
+    exception_ptr e;
+    if(!state.failed)
+    {
+        try
+        {
+            fn();
+        }
+        catch(...)
+        {
+            state.failed = true;
+            e = current_exception();
+        }
+    }
+    fn = nullptr;
+    lockIt.lock();
+    if(e && !state.firstException)
+        state.firstException = e;
+    if(--state.pendingCount == 0)
+        state.cond.notify_all();
+    return true;
+}
+
+void TaskGroup::run(function<void()> fn)
+{
+    if(state->failed)
+        return;
+    state->lock.lock();
+    state->queuedTasks.push_back(move(fn));
+    state->pendingCount++;
+    state->lock.unlock();
+    shared_ptr<State> taskState = state;
+    pool.submit([taskState]()
+    {
+        unique_lock<mutex> lockIt(taskState->lock);
+        runQueuedTask(*taskState, lockIt);
+    });
+}
+
+void TaskGroup::wait()
+{
+    unique_lock<mutex> lockIt(state->lock);
+    while(state->pendingCount > 0)
+    {
+        if(!runQueuedTask(*state, lockIt))
+            state->cond.wait(lockIt);
+    }
+    if(state->firstException)
+    {
+        exception_ptr e = state->firstException;
+        state->firstException = nullptr;
+        rethrow_exception(e);
+    }
+}
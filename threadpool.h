@@ -0,0 +1,116 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef THREADPOOL_H_INCLUDED
+#define THREADPOOL_H_INCLUDED
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <exception>
+
+using namespace std;
+
+/** work stealing thread pool : each worker runs tasks from the back of its own queue and
+ * steals from the front of the other workers' queues when it runs out.
+ */
+class ThreadPool final
+{
+    ThreadPool(const ThreadPool &) = delete;
+    const ThreadPool & operator =(const ThreadPool &) = delete;
+private:
+    struct WorkerQueue
+    {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+    vector<unique_ptr<WorkerQueue>> queues;
+    vector<thread> threads;
+    mutex sleepLock;
+    condition_variable sleepCond;
+    atomic_size_t queuedCount;
+    atomic_size_t nextQueue;
+    bool done = false;
+    bool popTask(size_t startIndex, bool isOwnQueue, function<void()> & task);
+    void workerFn(size_t index);
+public:
+    explicit ThreadPool(size_t threadCount = 0); // 0 means one thread per hardware thread
+    ~ThreadPool();
+    void submit(function<void()> task);
+    /** runs one queued task on the calling thread
+     * @return false if there weren't any queued tasks
+     */
+    bool runPendingTask();
+    size_t threadCount() const
+    {
+        return threads.size();
+    }
+    static ThreadPool & shared();
+};
+
+/** a batch of tasks run on a ThreadPool. After the first task throws, the tasks that haven't started yet are skipped.
+ * The tasks are queued in the group and the pool only gets tasks that run the next one, so wait can run the group's
+ * own tasks instead of other groups' and doesn't have to wait for pool threads that are busy elsewhere.
+ */
+class TaskGroup final
+{
+    TaskGroup(const TaskGroup &) = delete;
+    const TaskGroup & operator =(const TaskGroup &) = delete;
+private:
+    struct State
+    {
+        mutex lock;
+        condition_variable cond;
+        deque<function<void()>> queuedTasks;
+        size_t pendingCount = 0; // queued and running tasks
+        atomic_bool failed;
+        exception_ptr firstException;
+        State()
+            : failed(false)
+        {
+        }
+    };
+    ThreadPool & pool;
+    const shared_ptr<State> state; // shared with the pool's tasks, which may run after the group is gone
+    /** runs the next queued task of state, if there still is one
+     * @param lockIt holding state.lock, held again on return
+     * @return false if there weren't any queued tasks
+     */
+    static bool runQueuedTask(State & state, unique_lock<mutex> & lockIt);
+public:
+    explicit TaskGroup(ThreadPool & pool = ThreadPool::shared())
+        : pool(pool), state(make_shared<State>())
+    {
+    }
+    ~TaskGroup();
+    void run(function<void()> fn);
+    bool failed() const
+    {
+        return state->failed;
+    }
+    /** waits for all the tasks, running the group's queued tasks on the calling thread in the meantime
+     * @throw the first exception thrown by a task
+     */
+    void wait();
+};
+
+#endif // THREADPOOL_H_INCLUDED
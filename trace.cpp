@@ -0,0 +1,196 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#include "trace.h"
+#ifndef DISABLE_TRACING
+#include "stream.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+
+using namespace std;
+
+bool traceEnabled = false;
+
+namespace
+{
+struct Span
+{
+    const char * name;
+    int64_t beginTime; // nanoseconds since traceStartTime
+    int64_t endTime;
+    uint64_t id;
+};
+
+/** written only by its thread. A reader copies spans and then checks that the writer didn't lap them meanwhile. */
+struct Ring
+{
+    vector<Span> spans;
+    atomic<uint64_t> writeCount;
+    const unsigned threadIndex;
+    Ring(size_t size, unsigned threadIndex)
+        : spans(size), writeCount(0), threadIndex(threadIndex)
+    {
+    }
+};
+
+size_t ringSize = 0;
+const chrono::steady_clock::time_point traceStartTime = chrono::steady_clock::now();
+mutex ringsLock;
+vector<shared_ptr<Ring>> rings;
+unsigned nextThreadIndex = 1;
+
+struct RingHolder final
+{
+    shared_ptr<Ring> ring;
+    RingHolder()
+    {
+        lock_guard<mutex> lockIt(ringsLock);
+        ring = make_shared<Ring>(ringSize, nextThreadIndex++);
+        rings.push_back(ring);
+    }
+    ~RingHolder()
+    {
+        lock_guard<mutex> lockIt(ringsLock);
+        rings.erase(find(rings.begin(), rings.end(), ring));
+    }
+};
+
+int64_t getTraceTime(chrono::steady_clock::time_point t)
+{
+    return chrono::duration_cast<chrono::nanoseconds>(t - traceStartTime).count();
+}
+
+void appendJSONString(string & str, const char * value)
+{
+    str += '\"';
+    for(; *value != '\0'; value++)
+    {
+        if(*value == '\"' || *value == '\\')
+            str += '\\';
+        str += *value;
+    }
+    str += '\"';
+}
+}
+
+void setTraceRingSize(size_t newRingSize)
+{
+    ringSize = newRingSize;
+    traceEnabled = (ringSize > 0);
+}
+
+uint64_t & currentTraceId()
+{
+    static thread_local uint64_t id = 0;
+    return id;
+}
+
+void recordTraceSpan(const char * name, chrono::steady_clock::time_point beginTime, chrono::steady_clock::time_point endTime)
+{
+    static thread_local RingHolder holder;
+    Ring & ring = *holder.ring;
+    uint64_t writeCount = ring.writeCount.load(memory_order_relaxed);
+    Span & span = ring.spans[writeCount % ring.spans.size()];
+    span.name = name;
+    span.beginTime = getTraceTime(beginTime);
+    span.endTime = getTraceTime(endTime);
+    span.id = currentTraceId();
+    ring.writeCount.store(writeCount + 1, memory_order_release);
+}
+
+string formatTrace()
+{
+    vector<shared_ptr<Ring>> ringsCopy;
+    {
+        lock_guard<mutex> lockIt(ringsLock);
+        ringsCopy = rings;
+    }
+    string retval = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    char buffer[256];
+    for(const shared_ptr<Ring> & ring : ringsCopy)
+    {
+        uint64_t size = ring->spans.size();
+        uint64_t endCount = ring->writeCount.load(memory_order_acquire);
+        uint64_t startCount = (endCount > size ? endCount - size : 0);
+        vector<Span> spans;
+        for(uint64_t i = startCount; i < endCount; i++)
+            spans.push_back(ring->spans[i % size]);
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t laterCount = ring->writeCount.load(memory_order_relaxed);
+        // span number i is intact if neither span i + size nor the one being written (laterCount) reused its slot
+        size_t lappedCount = 0;
+        if(laterCount + 1 > startCount + size)
+            lappedCount = (size_t)min<uint64_t>(laterCount + 1 - startCount - size, spans.size());
+        for(size_t i = lappedCount; i < spans.size(); i++)
+        {
+            const Span & span = spans[i];
+            if(!first)
+                retval += ',';
+            first = false;
+            retval += "\n{\"name\":";
+            appendJSONString(retval, span.name);
+            snprintf(buffer, sizeof(buffer), ",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"connection\":%llu}}",
+                     (int)getpid(), ring->threadIndex, span.beginTime / 1000.0, (span.endTime - span.beginTime) / 1000.0, (unsigned long long)span.id);
+            retval += buffer;
+        }
+    }
+    retval += "\n]}\n";
+    return retval;
+}
+
+void startTraceExport(string fileName)
+{
+    sigset_t signals, allSignals, oldSignals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR2);
+    // the export thread starts with all signals blocked so it only gets the ones it waits for
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_SETMASK, &allSignals, &oldSignals);
+    thread([fileName, signals]()
+    {
+        for(;;)
+        {
+            int signal;
+            if(sigwait(&signals, &signal) != 0)
+                continue;
+            string trace = formatTrace();
+            string tempFileName = fileName + ".tmp";
+            FILE * f = fopen(tempFileName.c_str(), "w");
+            bool failed = (f == nullptr);
+            if(f != nullptr)
+            {
+                failed = (fwrite(trace.data(), 1, trace.size(), f) != trace.size());
+                failed = (fclose(f) != 0 || failed);
+            }
+            if(failed || rename(tempFileName.c_str(), fileName.c_str()) == -1)
+                cerr << "Error : can't write trace to " << fileName << " : " << strerror(errno) << endl;
+        }
+    }).detach();
+    sigaddset(&oldSignals, SIGUSR2);
+    pthread_sigmask(SIG_SETMASK, &oldSignals, nullptr);
+}
+
+#endif // DISABLE_TRACING
@@ -0,0 +1,101 @@
+/*
+ * Voxels is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Voxels is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Voxels; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+/** low overhead tracing of request processing, exported as Chrome trace_event JSON.
+ * Every thread writes complete spans (name, begin and end time, connection id) to its own ring buffer
+ * without locking, the oldest spans are overwritten. Define DISABLE_TRACING to compile all of it out.
+ */
+
+#ifndef DISABLE_TRACING
+
+/** enables tracing with ringSize spans kept per thread, 0 disables it. Has to be called before tracing threads start. */
+void setTraceRingSize(size_t ringSize);
+
+/** @return the id of the connection the calling thread works on, shown as an argument of its spans */
+uint64_t & currentTraceId();
+
+void recordTraceSpan(const char * name, chrono::steady_clock::time_point beginTime, chrono::steady_clock::time_point endTime);
+
+/** @return the spans of all threads as trace_event JSON */
+string formatTrace();
+
+/** starts a thread that writes formatTrace() to fileName whenever SIGUSR2 is received.
+ * Has to be called before any other threads are started, as SIGUSR2 is blocked to be received with sigwait.
+ */
+void startTraceExport(string fileName);
+
+extern bool traceEnabled;
+
+/** records a span from construction to destruction */
+class TraceScope final
+{
+    TraceScope(const TraceScope &) = delete;
+    const TraceScope & operator =(const TraceScope &) = delete;
+private:
+    const char * const name;
+    chrono::steady_clock::time_point beginTime;
+public:
+    explicit TraceScope(const char * name)
+        : name(name)
+    {
+        if(traceEnabled)
+            beginTime = chrono::steady_clock::now();
+    }
+    ~TraceScope()
+    {
+        if(traceEnabled)
+            recordTraceSpan(name, beginTime, chrono::steady_clock::now());
+    }
+};
+
+#define TRACE_CONCAT_HELPER(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_HELPER(a, b)
+/** traces the rest of the enclosing scope as a span called name, which has to be a string literal */
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+/** traces a span called name from beginTime until now */
+#define TRACE_SPAN(name, beginTime) do { if(traceEnabled) recordTraceSpan(name, beginTime, chrono::steady_clock::now()); } while(0)
+/** @return the current connection id, to hand to TRACE_SET_ID on another thread */
+#define TRACE_ID() (currentTraceId())
+#define TRACE_SET_ID(id) (currentTraceId() = (id))
+
+#else
+
+inline void setTraceRingSize(size_t)
+{
+}
+
+inline void startTraceExport(string)
+{
+}
+
+#define TRACE_SCOPE(name) do {} while(0)
+#define TRACE_SPAN(name, beginTime) do {} while(0)
+#define TRACE_ID() ((uint64_t)0)
+#define TRACE_SET_ID(id) ((void)(id))
+
+#endif // DISABLE_TRACING
+
+#endif // TRACE_H_INCLUDED